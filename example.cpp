@@ -1,6 +1,11 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <cstring>
+#include <bitset>
+#include <deque>
+#include <numeric>
+#include <vector>
 #include "tOS.h"
 
 using namespace std::chrono;
@@ -15,17 +20,28 @@ void print_log(const char *tag) {
 
 using c_time_t = decltype(std::chrono::high_resolution_clock::now());
 
+// 计数器的参数，可以在shell中通过"param set counter_param step 2"修改。
+struct CounterParam {
+    int step{1};
+    int period_ms{1000};
+    TOS_REFLECT(step, period_ms)
+};
+
 int publisher(int argc, const char *argv[]) {
     const auto node = Node::this_node();
     print_log("publisher");
     auto logger = node->make_logger();
-    auto p = node->make_publisher<OpenMode::FIND_OR_CREATE, c_time_t, 1>("timeval");
-    std::this_thread::sleep_for(1000ms);
-    c_time_t t1;
-    while (node->running) {
-        t1 = std::chrono::high_resolution_clock::now();
-        p.push(t1);
-        std::this_thread::sleep_for(1s);
+    auto p = node->make_publisher<OpenMode::FIND_OR_CREATE, Envelope<int>, 1>("counter");
+    auto param = node->make_param<OpenMode::FIND_OR_CREATE, CounterParam>("counter_param");
+    p.set_subscriber_callback([](std::size_t num) { std::cout << "counter subscribers: " << num << std::endl; });
+    // 信封自动带上序号和发布时间，不需要在消息中手动发送时间戳。
+    for (int i = 0; node->running;) {
+        // 没有订阅者时不生产，订阅者出现后立即开始。
+        if (!p.wait_for_subscribers(1s)) continue;
+        auto period = milliseconds(param->read()->period_ms);
+        p.push(Envelope<int>{i});
+        i += param->read()->step;
+        std::this_thread::sleep_for(period);
     }
     return 0;
 }
@@ -36,19 +52,66 @@ int subscriber(int argc, const char *argv[]) {
     auto node = Node::this_node();
     print_log("subscriber");
     auto logger = node->make_logger();
-    auto s = node->make_subscriber<OpenMode::FIND_OR_CREATE, c_time_t, 1>("timeval");
-    c_time_t t1{}, t2{};
+    auto s = node->make_subscriber<OpenMode::FIND_OR_CREATE, Envelope<int>, 1>("counter");
+    Envelope<int> e;
     while (node->running) {
-        if (s.pop(t1, 2s) != MessageStatus::OK) continue;
-        t2 = std::chrono::high_resolution_clock::now();
-        logger->log_i() << "dt: " << std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count()
-                        << "us" << std::endl;
+        if (s.pop(e, 2s) != MessageStatus::OK) continue;
+        auto dt = std::chrono::steady_clock::now() - e.stamp;
+        logger->log_i() << "#" << e.seq << " from " << e.source << ": " << e.data << ", dt: "
+                        << std::chrono::duration_cast<std::chrono::microseconds>(dt).count() << "us, lost: "
+                        << s.get_gap_num() << std::endl;
     }
     return 0;
 }
 
 ENTRY_EXPORT(subscriber);
 
+// 数据流：每5个计数求和后发布到counter_sum，在counter发布者的线程中直接处理，不需要单独的线程。
+int counter_flow(int argc, const char *argv[]) {
+    auto node = Node::this_node();
+    auto logger = node->make_logger();
+    auto f = node->make_subscriber<OpenMode::FIND_OR_CREATE, Envelope<int>, 1>("counter")
+             | flow::map([](const Envelope<int> &e) { return e.data; })
+             | flow::window(5)
+             | flow::map([](const std::vector<int> &v) { return std::accumulate(v.begin(), v.end(), 0); })
+             >> node->make_publisher<OpenMode::FIND_OR_CREATE, int, 4>("counter_sum");
+    auto s = node->make_subscriber<OpenMode::FIND_OR_CREATE, int, 4>("counter_sum");
+    int sum;
+    while (node->running) {
+        if (s.pop(sum, 2s) != MessageStatus::OK) continue;
+        logger->log_i() << "counter sum: " << sum << std::endl;
+    }
+    return 0;
+}
+
+ENTRY_EXPORT(counter_flow);
+
+// 协作式调度：任务在counter消息到达时被唤醒，不需要轮询，也不占用单独的线程。
+int scheduler(int argc, const char *argv[]) {
+    auto node = Node::this_node();
+    auto logger = node->make_logger();
+    // 调度器的生命周期必须大于被wake_on的订阅者。
+    Scheduler sched;
+    auto s = node->make_subscriber<OpenMode::FIND_OR_CREATE, Envelope<int>, 1>("counter");
+    auto id = sched.create_task("counter", 1, [&]() {
+        Envelope<int> e;
+        while (s.pop(e, 0s) == MessageStatus::OK) {
+            logger->log_i() << "task got #" << e.seq << ": " << e.data << std::endl;
+        }
+        return TaskStatus::wait();
+    });
+    sched.wake_on(s, id);
+    sched.create_task("watchdog", 0, [&]() {
+        if (node->running) return TaskStatus::sleep(100ms);
+        sched.stop();
+        return TaskStatus::exit();
+    });
+    sched.run();
+    return 0;
+}
+
+ENTRY_EXPORT(scheduler);
+
 int server(int argc, const char *argv[]) {
     auto node = Node::this_node();
     print_log("server");
@@ -80,6 +143,8 @@ int client(int argc, const char *argv[]) {
         auto f = c.emplace(ts);
         try {
             tm = f.get();
+        } catch (request_dropped_error &e) { // 请求容器满时被后来的请求覆盖
+            continue;
         } catch (std::future_error &e) {
             continue;
         }
@@ -103,7 +168,7 @@ int sync_waiter(int argc, const char *argv[]) {
     }
 
     while (node->running) {
-        sync->wait('e');
+        if (!sync->wait_for('e', 1s)) continue;
         logger->log_i() << "current mode: 'e'" << std::endl;
         std::this_thread::sleep_for(0.5s);
     }
@@ -139,6 +204,300 @@ int sync_setter(int argc, const char *argv[]) {
 
 ENTRY_EXPORT(sync_setter);
 
+struct SerialSample {
+    int id;
+    std::string name;
+    std::vector<float> data;
+    TOS_REFLECT(id, name, data)
+};
+
+struct PlainSample {
+    int id;
+    char name[16];
+    float data[256];
+};
+
+// 序列化性能测试，与直接内存拷贝对比。
+int serialize_bench(int argc, const char *argv[]) {
+    auto logger = Node::this_node()->make_logger();
+    constexpr int N = 100000;
+    SerialSample s1{1, "serialize", std::vector<float>(256, 1.f)}, s2;
+    PlainSample p1{1, "memcpy", {}}, p2{};
+    std::vector<unsigned char> buf;
+    std::size_t check = 0;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < N; i++) {
+        buf.clear();
+        s1.id = i;
+        serialize(s1, buf);
+        deserialize(s2, buf.data(), buf.size());
+        check += s2.id;
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < N; i++) {
+        buf.resize(sizeof(PlainSample));
+        p1.id = i;
+        std::memcpy(buf.data(), &p1, sizeof(PlainSample));
+        std::memcpy(&p2, buf.data(), sizeof(PlainSample));
+        check += p2.id;
+    }
+    auto t3 = std::chrono::high_resolution_clock::now();
+
+    logger->log_i() << "serialize: " << std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count() / N
+                    << "ns/op, memcpy: " << std::chrono::duration_cast<std::chrono::nanoseconds>(t3 - t2).count() / N
+                    << "ns/op (" << check << ")" << std::endl;
+    return 0;
+}
+
+ENTRY_EXPORT(serialize_bench);
+
+// 原有的折半查表lowbit和分组归并bitcnt，作为bitmap_bench的对照。
+namespace legacy {
+    inline std::size_t lowbit(std::uint64_t v) {
+        static std::size_t lowbit_map[] = {
+                -1u, 0, 1, 0, 2, 0, 1, 0,
+                3, 0, 1, 0, 2, 0, 1, 0,
+        };
+        if (v == 0) return -1;
+        std::size_t n = 0;
+        if (v & 0xffffffff) { v &= 0xffffffff; }
+        else { v >>= 32, n += 32; }
+        if (v & 0xffff) { v &= 0xffff; }
+        else { v >>= 16, n += 16; }
+        if (v & 0xff) { v &= 0xff; }
+        else { v >>= 8, n += 8; }
+        if (v & 0xf) { v &= 0xf; }
+        else { v >>= 4, n += 4; }
+        return n + lowbit_map[v];
+    }
+
+    inline std::size_t bitcnt(std::uint64_t v) {
+        std::uint64_t n = v - ((v >> 1) & 0x5555555555555555);
+        n = (n & 0x3333333333333333) + ((n >> 2) & 0x3333333333333333);
+        return (((n + (n >> 4)) & 0x0F0F0F0F0F0F0F0F) * 0x0101010101010101) >> 56;
+    }
+
+    // 逐字运算的多字bitmap，查找和计数使用上面的原有算法。
+    template<std::size_t N>
+    struct BigBitMap {
+        static constexpr std::size_t WORDS = (N + 63) / 64;
+        std::uint64_t words[WORDS]{};
+
+        void set_bit(std::size_t i) { words[i / 64] |= std::uint64_t(1) << (i % 64); }
+
+        std::size_t next_bit(std::size_t i) const {
+            if (++i >= N) return -1;
+            std::size_t w = i / 64;
+            std::uint64_t v = words[w] & (~std::uint64_t(0) << (i % 64));
+            while (v == 0) {
+                if (++w == WORDS) return -1;
+                v = words[w];
+            }
+            return w * 64 + legacy::lowbit(v);
+        }
+
+        std::size_t lowbit() const { return next_bit(-1); }
+
+        std::size_t bitcnt() const {
+            std::size_t n = 0;
+            for (auto w: words) n += legacy::bitcnt(w);
+            return n;
+        }
+
+        void operator|=(const BigBitMap &o) { for (std::size_t i = 0; i < WORDS; i++) words[i] |= o.words[i]; }
+
+        void andnot(const BigBitMap &o) { for (std::size_t i = 0; i < WORDS; i++) words[i] &= ~o.words[i]; }
+    };
+}
+
+// BitMap和BigBitMap性能测试，与原有的查表、分组归并算法及std::bitset对比。
+int bitmap_bench(int argc, const char *argv[]) {
+    auto logger = Node::this_node()->make_logger();
+    auto ns = [](auto dt, int n) { return std::chrono::duration_cast<std::chrono::nanoseconds>(dt).count() / n; };
+    std::size_t check = 0;
+
+    // 单字的lowbit和bitcnt
+    constexpr int M = 1 << 16, ROUND = 100;
+    std::vector<std::uint64_t> values(M);
+    std::uint64_t x = 88172645463325252ull;
+    for (auto &v: values) {
+        x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+        // 最低位1的位置在0~63间均匀分布。
+        v = (x | 1) << (x % 64);
+    }
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < ROUND; r++) for (auto v: values) check += legacy::lowbit(v);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < ROUND; r++) for (auto v: values) check += BitMap<BITMAP_SIZE_64>(v).lowbit();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < ROUND; r++) for (auto v: values) check += legacy::bitcnt(v);
+    auto t3 = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < ROUND; r++) for (auto v: values) check += BitMap<BITMAP_SIZE_64>(v).bitcnt();
+    auto t4 = std::chrono::high_resolution_clock::now();
+    logger->log_i() << "lowbit: old " << ns((t1 - t0) * 1000, M * ROUND) << "ps/op, new "
+                    << ns((t2 - t1) * 1000, M * ROUND) << "ps/op; bitcnt: old "
+                    << ns((t3 - t2) * 1000, M * ROUND) << "ps/op, new "
+                    << ns((t4 - t3) * 1000, M * ROUND) << "ps/op" << std::endl;
+
+    // 多字的遍历、批量运算和计数
+    constexpr std::size_t BITS = 4096;
+    constexpr int N = 10000;
+    BigBitMap<BITS> a, b;
+    legacy::BigBitMap<BITS> la, lb;
+    std::bitset<BITS> sa, sb;
+    for (std::size_t i = 0; i < BITS; i += 37) a.set_bit(i), la.set_bit(i), sa.set(i);
+    for (std::size_t i = 0; i < BITS; i += 53) b.set_bit(i), lb.set_bit(i), sb.set(i);
+
+    auto t5 = std::chrono::high_resolution_clock::now();
+    for (int n = 0; n < N; n++) {
+        for (auto i = la.lowbit(); i != static_cast<std::size_t>(-1); i = la.next_bit(i)) check += i;
+        la |= lb;
+        la.andnot(lb);
+        check += la.bitcnt();
+    }
+    auto t6 = std::chrono::high_resolution_clock::now();
+    for (int n = 0; n < N; n++) {
+        for (auto i = a.lowbit(); i != static_cast<std::size_t>(-1); i = a.next_bit(i)) check += i;
+        a |= b;
+        a.andnot(b);
+        check += a.bitcnt();
+    }
+    auto t7 = std::chrono::high_resolution_clock::now();
+    for (int n = 0; n < N; n++) {
+        for (std::size_t i = 0; i < BITS; i++) if (sa[i]) check += i;
+        sa |= sb;
+        sa &= ~sb;
+        check += sa.count();
+    }
+    auto t8 = std::chrono::high_resolution_clock::now();
+    logger->log_i() << "BigBitMap<" << BITS << ">: old " << ns(t6 - t5, N) << "ns/op, new " << ns(t7 - t6, N)
+                    << "ns/op, std::bitset " << ns(t8 - t7, N) << "ns/op (" << check << ")" << std::endl;
+    return 0;
+}
+
+ENTRY_EXPORT(bitmap_bench);
+
+struct CameraSample {
+    steady_clock::time_point stamp;
+    int id;
+};
+
+struct ImuSample {
+    steady_clock::time_point stamp;
+    float acc[3];
+};
+
+// 近似时间同步性能测试，1个相机对应10个IMU，每批处理50帧，与线性扫描缓冲区对比。
+int time_sync_bench(int argc, const char *argv[]) {
+    auto node = Node::this_node();
+    auto logger = node->make_logger();
+    constexpr int N = 100000, RATIO = 10, BATCH = 50;
+    constexpr auto PERIOD = microseconds(1000);
+    auto cam = node->make_publisher<OpenMode::FIND_OR_CREATE, CameraSample, 1024>("bench_cam");
+    auto imu = node->make_publisher<OpenMode::FIND_OR_CREATE, ImuSample, 1024>("bench_imu");
+    TimeSynchronizer sync(PERIOD / RATIO, 2 * BATCH * RATIO,
+                          node->make_subscriber<OpenMode::FIND_OR_CREATE, CameraSample, 1024>("bench_cam"),
+                          node->make_subscriber<OpenMode::FIND_OR_CREATE, ImuSample, 1024>("bench_imu"));
+    decltype(sync)::ValType out;
+    auto t0 = steady_clock::time_point();
+    std::size_t matched = 0, check = 0;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < N; i += BATCH) {
+        for (int b = i; b < i + BATCH; b++) {
+            cam.push(CameraSample{t0 + b * PERIOD + PERIOD / 3, b});
+            for (int k = 0; k < RATIO; k++) imu.push(ImuSample{t0 + b * PERIOD + k * PERIOD / RATIO, {}});
+        }
+        while (sync.pop(out, 0ms) == MessageStatus::OK) {
+            matched++;
+            check += std::get<0>(out).id;
+        }
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    // 手写的线性扫描缓冲区，同样经过订阅器取得消息。
+    auto cam_linear = node->make_publisher<OpenMode::FIND_OR_CREATE, CameraSample, 1024>("bench_cam_linear");
+    auto imu_linear = node->make_publisher<OpenMode::FIND_OR_CREATE, ImuSample, 1024>("bench_imu_linear");
+    auto cam_sub = node->make_subscriber<OpenMode::FIND_OR_CREATE, CameraSample, 1024>("bench_cam_linear");
+    auto imu_sub = node->make_subscriber<OpenMode::FIND_OR_CREATE, ImuSample, 1024>("bench_imu_linear");
+    std::deque<CameraSample> cams;
+    std::deque<ImuSample> imus;
+    CameraSample c_in{};
+    ImuSample i_in{};
+    std::size_t matched_linear = 0;
+    for (int i = 0; i < N; i += BATCH) {
+        for (int b = i; b < i + BATCH; b++) {
+            cam_linear.push(CameraSample{t0 + b * PERIOD + PERIOD / 3, b});
+            for (int k = 0; k < RATIO; k++) imu_linear.push(ImuSample{t0 + b * PERIOD + k * PERIOD / RATIO, {}});
+        }
+        while (cam_sub.pop(c_in, 0ms) == MessageStatus::OK) cams.push_back(c_in);
+        while (imu_sub.pop(i_in, 0ms) == MessageStatus::OK) imus.push_back(i_in);
+        while (!cams.empty()) {
+            auto &c = cams.front();
+            auto best = imus.end();
+            for (auto it = imus.begin(); it != imus.end(); ++it) {
+                auto d = it->stamp > c.stamp ? it->stamp - c.stamp : c.stamp - it->stamp;
+                if (d <= PERIOD / RATIO && (best == imus.end() || d < (best->stamp > c.stamp ? best->stamp - c.stamp
+                                                                                             : c.stamp - best->stamp)))
+                    best = it;
+            }
+            if (best == imus.end()) break;
+            matched_linear++;
+            check += c.id;
+            imus.erase(imus.begin(), best + 1);
+            cams.pop_front();
+        }
+    }
+    auto t3 = std::chrono::high_resolution_clock::now();
+
+    logger->log_i() << "TimeSynchronizer: " << std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count() / N
+                    << "ns/frame (" << matched << " matched, " << sync.get_drop_num() << " dropped), linear scan: "
+                    << std::chrono::duration_cast<std::chrono::nanoseconds>(t3 - t2).count() / N
+                    << "ns/frame (" << matched_linear << " matched) (" << check << ")" << std::endl;
+    return 0;
+}
+
+ENTRY_EXPORT(time_sync_bench);
+
+// 同线程两级处理链的性能测试：回调式订阅者直接调用，与经过容器的push/pop对比。
+int direct_dispatch_bench(int argc, const char *argv[]) {
+    auto node = Node::this_node();
+    auto logger = node->make_logger();
+    constexpr int N = 1000000;
+    std::size_t check = 0;
+
+    auto src = node->make_publisher<OpenMode::FIND_OR_CREATE, int, 16>("bench_stage_0");
+    auto mid_sub = node->make_subscriber<OpenMode::FIND_OR_CREATE, int, 16>("bench_stage_0");
+    auto mid = node->make_publisher<OpenMode::FIND_OR_CREATE, int, 16>("bench_stage_1");
+    auto dst_sub = node->make_subscriber<OpenMode::FIND_OR_CREATE, int, 16>("bench_stage_1");
+    mid_sub.set_callback([&mid](const int &x) { mid.push(x * 2); });
+    dst_sub.set_callback([&check](const int &x) { check += x; });
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < N; i++) src.push(i);
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    auto src_q = node->make_publisher<OpenMode::FIND_OR_CREATE, int, 16>("bench_stage_0_queued");
+    auto mid_q_sub = node->make_subscriber<OpenMode::FIND_OR_CREATE, int, 16>("bench_stage_0_queued");
+    auto mid_q = node->make_publisher<OpenMode::FIND_OR_CREATE, int, 16>("bench_stage_1_queued");
+    auto dst_q_sub = node->make_subscriber<OpenMode::FIND_OR_CREATE, int, 16>("bench_stage_1_queued");
+    int x;
+    for (int i = 0; i < N; i++) {
+        src_q.push(i);
+        mid_q_sub.pop(x);
+        mid_q.push(x * 2);
+        dst_q_sub.pop(x);
+        check += x;
+    }
+    auto t3 = std::chrono::high_resolution_clock::now();
+
+    logger->log_i() << "direct: " << std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count() / N
+                    << "ns/msg, queued: " << std::chrono::duration_cast<std::chrono::nanoseconds>(t3 - t2).count() / N
+                    << "ns/msg (" << check << ")" << std::endl;
+    return 0;
+}
+
+ENTRY_EXPORT(direct_dispatch_bench);
+
 int my_stacktrace_test(int argc, const char *argv[]) {
     throw std::runtime_error("test stacktrace.");
     return 0;
@@ -0,0 +1,157 @@
+//
+// Created by xinyang on 2020/9/30.
+//
+
+#ifndef TOS_AQM_H
+#define TOS_AQM_H
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+
+namespace tOS {
+    // 带入队时间戳的容器元素，时间戳为默认值表示入队时未开启AQM。
+    template<class T>
+    struct Stamped {
+        T value;
+        std::chrono::steady_clock::time_point stamp;
+
+        // 由T的构造参数原地构造元素，不经过临时对象。
+        template<class ...Ts>
+        explicit Stamped(std::chrono::steady_clock::time_point s, Ts &&...args) :
+                value(make(std::forward<Ts>(args)...)), stamp(s) {}
+
+    private:
+        // 返回纯右值，保证复制消除。
+        template<class ...Ts>
+        static T make(Ts &&...args) {
+            if constexpr(std::is_constructible_v<T, Ts &&...>) return T(std::forward<Ts>(args)...);
+            else return T{std::forward<Ts>(args)...};
+        }
+    };
+
+    // 从Stamped元素中取出原元素再交给Key，使优先级和截止时间不受时间戳影响。
+    template<class Key>
+    struct StampedKey {
+        template<class U>
+        const auto &operator()(const U &u) const { return Key()(u.value); }
+    };
+
+    /* 主动队列管理策略
+     * enable: 是否开启
+     * target: 可接受的排队时延
+     * interval: 排队时延持续超过target多久后开始丢弃，一般取消费者处理一批数据的最长时间
+     * limit: 排队时延的硬上限，超过者直接丢弃，用于生产速度不受丢弃影响的数据源。为0时不限制
+     */
+    struct AQMPolicy {
+        bool enable{false};
+        std::chrono::nanoseconds target{std::chrono::milliseconds(5)};
+        std::chrono::nanoseconds interval{std::chrono::milliseconds(100)};
+        std::chrono::nanoseconds limit{std::chrono::milliseconds(100)};
+    };
+
+    // 主动队列管理的统计信息
+    struct AQMStat {
+        // 因排队时延过长而丢弃的个数
+        std::size_t dropped{0};
+        // 因容器满而覆盖或丢弃的个数
+        std::size_t evicted{0};
+        // 最近一个出队元素的排队时延
+        std::chrono::nanoseconds sojourn{0};
+    };
+
+    /* CoDel主动队列管理
+     * 出队时根据元素的排队时延判断是否丢弃：时延持续interval超过target后进入丢弃状态，
+     * 丢弃间隔按interval/sqrt(count)逐渐缩短，直到时延回落到target以下。
+     * 此外排队时延超过limit的元素总是被丢弃。
+     * 只在出队时判断，不会丢弃队列中的最后一个元素，因此不影响吞吐。
+     * 非线程安全，需在容器的锁内使用。
+     */
+    class CoDel {
+    private:
+        using time_point = std::chrono::steady_clock::time_point;
+
+        AQMPolicy policy;
+        AQMStat stat;
+        // 时延首次超过target后，开始丢弃的时刻
+        time_point first_above{};
+        // 丢弃状态下，下一次丢弃的时刻
+        time_point drop_next{};
+        std::size_t count{0}, last_count{0};
+        bool dropping{false};
+
+        time_point control_law(time_point t) const {
+            return t + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    policy.interval / std::sqrt(static_cast<double>(count)));
+        }
+
+        bool ok_to_drop(time_point now, bool last) {
+            if (stat.sojourn < policy.target || last) {
+                first_above = {};
+                return false;
+            }
+            if (first_above == time_point{}) {
+                first_above = now + policy.interval;
+                return false;
+            }
+            return now >= first_above;
+        }
+
+    public:
+        void set_policy(const AQMPolicy &p) {
+            policy = p;
+            first_above = drop_next = {};
+            count = last_count = 0;
+            dropping = false;
+        }
+
+        const AQMPolicy &get_policy() const { return policy; }
+
+        const AQMStat &get_stat() const { return stat; }
+
+        // 入队时调用，返回元素的时间戳。
+        time_point stamp() const {
+            return policy.enable ? std::chrono::steady_clock::now() : time_point{};
+        }
+
+        // 容器满而覆盖或丢弃元素时调用。
+        void evicted() { stat.evicted++; }
+
+        /* 出队时调用，返回该元素是否应被丢弃。
+         * stamp: 元素的时间戳
+         * last: 该元素是否为队列中的最后一个元素
+         */
+        bool drop(time_point stamp, bool last) {
+            if (!policy.enable || stamp == time_point{}) return false;
+            auto now = std::chrono::steady_clock::now();
+            stat.sojourn = now - stamp;
+            bool ok = ok_to_drop(now, last);
+            if (!last && policy.limit.count() > 0 && stat.sojourn > policy.limit) {
+                stat.dropped++;
+                return true;
+            }
+            if (dropping) {
+                if (!ok) {
+                    dropping = false;
+                    return false;
+                }
+                if (now < drop_next) return false;
+                count++;
+                drop_next = control_law(drop_next);
+                stat.dropped++;
+                return true;
+            }
+            if (!ok) return false;
+            // 进入丢弃状态。距上次丢弃状态不久时沿用之前的丢弃频率。
+            dropping = true;
+            auto delta = count - last_count;
+            count = (delta > 1 && now - drop_next < 16 * policy.interval) ? delta : 1;
+            drop_next = control_law(now);
+            last_count = count;
+            stat.dropped++;
+            return true;
+        }
+    };
+}
+
+#endif /* TOS_AQM_H */
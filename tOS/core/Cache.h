@@ -0,0 +1,153 @@
+//
+// Created by xinyang on 2020/10/3.
+//
+
+#ifndef TOS_CACHE_H
+#define TOS_CACHE_H
+
+#include "ObjInfo.h"
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace tOS {
+    /* 请求结果缓存策略
+     * ttl: 结果的有效期，自请求发出时开始计算
+     * max_size: 最多缓存的结果个数，超过时淘汰最久未使用的结果
+     */
+    struct CachePolicy {
+        std::chrono::nanoseconds ttl{std::chrono::seconds(1)};
+        std::size_t max_size{64};
+    };
+
+    // 请求结果缓存的统计信息
+    struct CacheStat {
+        // 直接返回已有结果的次数
+        std::size_t hit{0};
+        // 需要发出新请求的次数
+        std::size_t miss{0};
+        // 合并到正在处理的相同请求上的次数
+        std::size_t coalesced{0};
+        // 因超过max_size而淘汰的结果个数
+        std::size_t evicted{0};
+        // 当前缓存的结果个数
+        std::size_t size{0};
+    };
+
+    // 类型擦除的缓存接口，用于shell查看和清空缓存。
+    class CacheInfo : public ObjInfo {
+    public:
+        virtual CacheStat get_stat() = 0;
+
+        virtual void clear() = 0;
+    };
+
+    /* 请求结果缓存
+     * 相同的请求在处理中时共享同一个结果，处理完成后在ttl内直接返回该结果。
+     * 请求失败（被丢弃或超时）的结果不会被缓存。
+     * S: 请求元素类型，需要可以哈希
+     * B: 请求返回类型
+     */
+    template<class S, class B, class Hash = std::hash<S>, class Equal = std::equal_to<S>>
+    class RequestCache : public CacheInfo {
+    private:
+        using time_point = std::chrono::steady_clock::time_point;
+
+        struct Entry {
+            std::shared_future<B> f;
+            time_point expire;
+            // 在lru中的位置
+            typename std::list<const S *>::iterator pos;
+        };
+
+        std::unordered_map<S, Entry, Hash, Equal> map;
+        // 最近使用的在前，保存map中键的地址
+        std::list<const S *> lru;
+        CachePolicy policy;
+        CacheStat stat;
+        std::mutex mtx;
+
+        void erase(typename std::unordered_map<S, Entry, Hash, Equal>::iterator iter) {
+            lru.erase(iter->second.pos);
+            map.erase(iter);
+        }
+
+        // 结果是否已经完成且失败。
+        static bool failed(const std::shared_future<B> &f) {
+            if (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+            try {
+                f.get();
+                return false;
+            } catch (...) {
+                return true;
+            }
+        }
+
+    public:
+        void set_policy(const CachePolicy &p) {
+            std::unique_lock lock(mtx);
+            policy = p;
+            while (map.size() > policy.max_size) {
+                erase(map.find(*lru.back()));
+                stat.evicted++;
+            }
+        }
+
+        CacheStat get_stat() override {
+            std::unique_lock lock(mtx);
+            auto s = stat;
+            s.size = map.size();
+            return s;
+        }
+
+        void clear() override {
+            std::unique_lock lock(mtx);
+            lru.clear();
+            map.clear();
+        }
+
+        // 使某个请求的结果失效。
+        void invalidate(const S &req) {
+            std::unique_lock lock(mtx);
+            auto iter = map.find(req);
+            if (iter != map.end()) erase(iter);
+        }
+
+        /* 查找请求的结果，不存在时调用call(req)发出请求。
+         * call: 返回std::shared_future<B>，在锁内调用，因此不能阻塞
+         */
+        template<class Call>
+        std::shared_future<B> get(const S &req, Call &&call) {
+            auto now = std::chrono::steady_clock::now();
+            std::unique_lock lock(mtx);
+            auto iter = map.find(req);
+            if (iter != map.end()) {
+                auto &e = iter->second;
+                if (e.expire > now && !failed(e.f)) {
+                    if (e.f.wait_for(std::chrono::seconds(0)) == std::future_status::ready) stat.hit++;
+                    else stat.coalesced++;
+                    lru.splice(lru.begin(), lru, e.pos);
+                    return e.f;
+                }
+                erase(iter);
+            }
+            stat.miss++;
+            auto f = call(req);
+            if (policy.max_size == 0) return f;
+            if (map.size() >= policy.max_size) {
+                erase(map.find(*lru.back()));
+                stat.evicted++;
+            }
+            auto new_iter = map.emplace(req, Entry{f, now + policy.ttl, {}}).first;
+            lru.push_front(&new_iter->first);
+            new_iter->second.pos = lru.begin();
+            return f;
+        }
+    };
+}
+
+#endif /* TOS_CACHE_H */
@@ -5,16 +5,130 @@
 #ifndef TOS_CONTAINER_H
 #define TOS_CONTAINER_H
 
+#include "../utils/CircularQueue.h"
+#include "../utils/Stack.h"
+#include "../utils/PriorityQueue.h"
+#include "../utils/ConflatingQueue.h"
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+
 namespace tOS {
     // 空类型，作为占位符代替void。
     // 占用一个字节，略有性能损失。
     class Empty {
     };
 
-    // 消息容器枚举
+    /* 消息容器枚举
+     * CIRCULAR_QUEUE: 先进先出
+     * STACK: 后进先出
+     * PRIORITY: 优先级高者先出，元素通过operator<比较，越大越优先，相同时先进先出。满时丢弃优先级最低者，包括新元素
+     * EDF: 截止时间早者先出，元素需提供可比较的成员deadline，相同时先进先出。满时丢弃截止时间最晚者，包括新元素
+     * CONFLATE: 先进先出，键相同的元素只保留最新的一个且保持原排队位置，
+     *           键默认为元素的成员key，可以通过特化ConflateKey指定
+     */
     enum ContainerEnum {
-        CIRCULAR_QUEUE, STACK
+        CIRCULAR_QUEUE, STACK, PRIORITY, EDF, CONFLATE
+    };
+
+    // 用于判断一个值是否为合法的容器枚举。
+    template<ContainerEnum Container>
+    constexpr bool isContainerEnum = Container == CIRCULAR_QUEUE || Container == STACK ||
+                                     Container == PRIORITY || Container == EDF || Container == CONFLATE;
+
+    // 从元素中取出参与排序的部分，默认为元素本身。
+    struct KeyIdentity {
+        template<class U>
+        const U &operator()(const U &u) const { return u; }
+    };
+
+    // 从std::pair元素中取出first参与排序，用于请求包。
+    struct KeyFirst {
+        template<class U>
+        const auto &operator()(const U &u) const { return u.first; }
+    };
+
+    template<class Key>
+    struct PriorityCompare {
+        template<class U>
+        bool operator()(const U &a, const U &b) const { return Key()(a) < Key()(b); }
+    };
+
+    template<class Key>
+    struct DeadlineCompare {
+        template<class U>
+        bool operator()(const U &a, const U &b) const { return Key()(b).deadline < Key()(a).deadline; }
+    };
+
+    template<class Key>
+    struct ConflateKeyOf {
+        template<class U>
+        const auto &operator()(const U &u) const {
+            const auto &v = Key()(u);
+            return ConflateKey<std::decay_t<decltype(v)>>()(v);
+        }
+    };
+
+    /* 由容器枚举得到容器类型
+     * Key: 从元素中取出参与排序或合并的部分，仅对PRIORITY、EDF和CONFLATE有效
+     */
+    template<class T, std::size_t SIZE, ContainerEnum Container, class Key = KeyIdentity>
+    using ContainerType = std::conditional_t<Container == CIRCULAR_QUEUE, CircularQueue<T, SIZE, false>,
+            std::conditional_t<Container == STACK, Stack<T, SIZE, false>,
+                    std::conditional_t<Container == PRIORITY, PriorityQueue<T, SIZE, false, PriorityCompare<Key>>,
+                            std::conditional_t<Container == EDF, PriorityQueue<T, SIZE, false, DeadlineCompare<Key>>,
+                                    ConflatingQueue<T, SIZE, false, ConflateKeyOf<Key>>>>>>;
+
+    // 运行时确定的容器容量
+    struct Capacity {
+        std::size_t capacity;       // 首次分配的容量
+        std::size_t max_capacity;   // 最大容量，不大于capacity时容量固定
+    };
+
+    /* 按名称配置的容器容量，可以在启动脚本中通过capacity命令设置。
+     * 创建SIZE为DYNAMIC_SIZE的消息或请求包时优先使用此处的配置，而不是代码中给出的容量。
+     */
+    struct CapacityMap {
+        std::mutex mtx;
+        std::unordered_map<std::string, Capacity> map;
     };
+
+    inline CapacityMap capacity_map;
+
+    inline void set_capacity(const std::string &name, const Capacity &cap) {
+        std::unique_lock lock(capacity_map.mtx);
+        capacity_map.map[name] = cap;
+    }
+
+    inline Capacity get_capacity(const std::string &name, const Capacity &def) {
+        std::unique_lock lock(capacity_map.mtx);
+        auto iter = capacity_map.map.find(name);
+        return iter == capacity_map.map.end() ? def : iter->second;
+    }
+
+    /* 容器满时为obj腾出一个位置，返回是否放入obj。
+     * 优先队列丢弃优先级最低的元素，但obj不比它更优先时保留队列，丢弃obj本身；其余容器丢弃下一个将被取出的元素。
+     * obj: 将要放入的元素，不是优先队列时可以为nullptr
+     */
+    template<class C, class U>
+    inline bool evict(C &c, const U *obj) {
+        if constexpr(isPriorityQueue<C>) {
+            return c.evict(*obj);
+        } else {
+            c.pop();
+            return true;
+        }
+    }
+
+    /* 放入obj前是否需要腾出位置：合并队列中已有相同键的元素时原地替换，不占用新的位置。
+     * obj: 将要放入的元素，不是合并队列时可以为nullptr
+     */
+    template<class C, class U>
+    inline bool overflow(const C &c, const U *obj) {
+        if constexpr(isConflatingQueue<C>) return c.full() && !c.contains(*obj);
+        else return c.full();
+    }
 }
 
 #endif /* TOS_CONTAINER_H */
@@ -0,0 +1,191 @@
+//
+// Created by xinyang on 2020/10/5.
+//
+
+#ifndef TOS_ENVELOPE_H
+#define TOS_ENVELOPE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+namespace tOS {
+    // 字符串驻留，返回的指针在进程内一直有效，用于在消息中低开销地携带node名称。
+    inline const char *intern(const std::string &s) {
+        static std::mutex mtx;
+        static std::unordered_set<std::string> set;
+        std::unique_lock lock(mtx);
+        return set.insert(s).first->c_str();
+    }
+
+    // 当前线程所属node的名称，由Node设置。
+    inline thread_local const char *envelope_node = "";
+
+    /* 当前线程正在处理的数据的源头，只在订阅者的回调执行期间设置，返回后恢复，
+     * 回调中发布的信封沿用该源头。通过pop取得的信封不设置，需要时用Envelope::derive_from显式声明。
+     */
+    struct EnvelopeOrigin {
+        std::chrono::steady_clock::time_point stamp{};
+        const char *source{nullptr};
+    };
+
+    inline thread_local EnvelopeOrigin envelope_origin;
+
+    // 在作用域内把当前线程的数据源头设为e的源头，退出时（包括异常）恢复。
+    class OriginScope {
+    private:
+        EnvelopeOrigin saved{envelope_origin};
+    public:
+        template<class E>
+        explicit OriginScope(const E &e) { envelope_origin = {e.origin, e.origin_source}; }
+
+        ~OriginScope() { envelope_origin = saved; }
+
+        OriginScope(const OriginScope &) = delete;
+
+        OriginScope &operator=(const OriginScope &) = delete;
+    };
+
+    /* 消息信封，发布时自动填写以下字段：
+     * seq: 在该消息上的序号，从1开始，订阅者据此检测被覆盖而丢失的消息
+     * stamp, source: 发布时间和发布node
+     * origin, origin_source: 数据源头的发布时间和node，在回调中发布或通过derive_from声明时沿用收到的信封的源头，
+     *                         否则以自身为源头
+     * T: 消息内容类型
+     */
+    template<class T>
+    struct Envelope {
+        T data;
+        std::uint64_t seq{0};
+        std::chrono::steady_clock::time_point stamp{};
+        const char *source{nullptr};
+        std::chrono::steady_clock::time_point origin{};
+        const char *origin_source{nullptr};
+
+        // 声明该信封由src派生，发布时沿用src的源头。
+        template<class U>
+        Envelope &derive_from(const Envelope<U> &src) {
+            origin = src.origin;
+            origin_source = src.origin_source;
+            return *this;
+        }
+    };
+
+    // 用于判断一个类型是否为Envelope。
+    template<class T>
+    constexpr bool isEnvelope = false;
+
+    template<class T>
+    constexpr bool isEnvelope<Envelope<T>> = true;
+
+    /* 发布前填写信封，seq为调用者分配的序号。
+     * 放入容器的消息需在消息的锁内分配序号并填写，保证每个容器中的序号递增。
+     */
+    template<class T>
+    void seal(Envelope<T> &e, std::uint64_t seq) {
+        e.seq = seq;
+        e.stamp = std::chrono::steady_clock::now();
+        e.source = envelope_node;
+        if (e.origin != std::chrono::steady_clock::time_point{}) return;
+        if (envelope_origin.source != nullptr) {
+            e.origin = envelope_origin.stamp;
+            e.origin_source = envelope_origin.source;
+        } else {
+            e.origin = e.stamp;
+            e.origin_source = e.source;
+        }
+    }
+
+    /* 端到端时延直方图，桶i统计[2^i, 2^(i+1))纳秒的时延。
+     * 只使用原子操作，可以被多个订阅者同时记录。
+     */
+    class LatencyHistogram {
+    public:
+        static constexpr std::size_t BUCKETS = 40;
+
+    private:
+        std::array<std::atomic_size_t, BUCKETS> buckets{};
+        std::atomic_size_t count{0};
+        std::atomic_uint64_t sum{0}, max{0};
+
+    public:
+        void record(std::chrono::nanoseconds dt) {
+            auto ns = static_cast<std::uint64_t>(dt.count() > 0 ? dt.count() : 0);
+            std::size_t i = 0;
+            while (i + 1 < BUCKETS && (ns >> (i + 1)) != 0) i++;
+            buckets[i].fetch_add(1, std::memory_order_relaxed);
+            count.fetch_add(1, std::memory_order_relaxed);
+            sum.fetch_add(ns, std::memory_order_relaxed);
+            auto m = max.load(std::memory_order_relaxed);
+            while (ns > m && !max.compare_exchange_weak(m, ns, std::memory_order_relaxed));
+        }
+
+        void clear() {
+            for (auto &b: buckets) b = 0;
+            count = 0;
+            sum = 0;
+            max = 0;
+        }
+
+        std::size_t get_count() const { return count; }
+
+        std::chrono::nanoseconds get_mean() const {
+            return std::chrono::nanoseconds(count == 0 ? 0 : sum / count);
+        }
+
+        std::chrono::nanoseconds get_max() const { return std::chrono::nanoseconds(max); }
+
+        // 百分位时延的上界，p取值[0, 1]。
+        std::chrono::nanoseconds get_percentile(double p) const {
+            std::size_t total = count, acc = 0;
+            if (total == 0) return std::chrono::nanoseconds(0);
+            for (std::size_t i = 0; i < BUCKETS; i++) {
+                acc += buckets[i];
+                if (acc >= p * total) return std::min(std::chrono::nanoseconds(std::int64_t(2) << i), get_max());
+            }
+            return get_max();
+        }
+    };
+
+    // 各数据链路的时延直方图，键为"源头node -> 接收node"，可以在shell中查看。
+    inline struct LatencyMap {
+        std::mutex mtx;
+        std::map<std::string, LatencyHistogram> map;
+    } latency_map;
+
+    // 订阅者的信封统计：根据序号检测丢失的消息，并记录源头到当前node的时延。
+    struct EnvelopeTracker {
+        std::uint64_t last_seq{0};
+        // 序号不连续而丢失的消息数，被过滤或限频跳过的消息也计入
+        std::size_t gap{0};
+        // 最近一个源头及其直方图
+        const char *source{nullptr};
+        LatencyHistogram *histogram{nullptr};
+
+        template<class T>
+        void receive(const Envelope<T> &e) {
+            if (e.seq > last_seq) {
+                if (last_seq != 0) gap += e.seq - last_seq - 1;
+                last_seq = e.seq;
+            } else if (gap > 0) {
+                // 直接调用与其他线程经容器发布的消息交错时，后者可能迟到，填补之前计入的缺口。
+                gap--;
+            }
+            if (e.origin_source == nullptr) return;
+            if (e.origin_source != source) {
+                std::unique_lock lock(latency_map.mtx);
+                source = e.origin_source;
+                histogram = &latency_map.map[std::string(source) + " -> " + envelope_node];
+            }
+            histogram->record(std::chrono::steady_clock::now() - e.origin);
+        }
+    };
+}
+
+#endif /* TOS_ENVELOPE_H */
@@ -0,0 +1,407 @@
+//
+// Created by xinyang on 2020/10/7.
+//
+
+#ifndef TOS_FLOW_H
+#define TOS_FLOW_H
+
+#include "../tOS_config.h"
+#include "Message.h"
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace tOS {
+    /* 话题上的数据流算子，将轻量的数据处理融合在一起，不需要单独的node、线程和中间话题：
+     *     auto f = sub | flow::map(f) | flow::filter(p) | flow::window(n) >> pub;
+     * 各算子在源话题发布者的线程中依次直接调用，算子之间传递引用而不复制。
+     * 返回的Flow析构时停止处理。同一个Flow的处理是串行的，多个线程向源话题发布时依次执行。
+     * 流水线的输出不能直接或间接回到自身的输入。
+     */
+    namespace flow {
+        // 算子的基类，用于识别算子类型。
+        struct Stage {
+        };
+
+        template<class T>
+        constexpr bool isStage = std::is_base_of_v<Stage, std::decay_t<T>>;
+
+        // 逐个变换：输出f(x)。
+        template<class F>
+        struct Map : public Stage {
+            F f;
+
+            template<class In>
+            struct State {
+                using Out = std::decay_t<std::invoke_result_t<F &, const In &>>;
+                F f;
+
+                explicit State(Map &&m) : f(std::move(m.f)) {}
+
+                template<class V, class Next>
+                void operator()(V &&v, Next &&next) { next(f(std::forward<V>(v))); }
+            };
+        };
+
+        // 过滤：只输出p(x)为true的元素。
+        template<class P>
+        struct Filter : public Stage {
+            P p;
+
+            template<class In>
+            struct State {
+                using Out = In;
+                P p;
+
+                explicit State(Filter &&f) : p(std::move(f.p)) {}
+
+                template<class V, class Next>
+                void operator()(V &&v, Next &&next) {
+                    if (p(static_cast<const In &>(v))) next(std::forward<V>(v));
+                }
+            };
+        };
+
+        // 滚动窗口：每n个元素输出一次std::vector，缓冲区在窗口之间复用。
+        struct Window : public Stage {
+            std::size_t n;
+
+            template<class In>
+            struct State {
+                using Out = std::vector<In>;
+                std::size_t n;
+                std::vector<In> buf;
+
+                explicit State(Window &&w) : n(std::max<std::size_t>(w.n, 1)) { buf.reserve(n); }
+
+                template<class V, class Next>
+                void operator()(V &&v, Next &&next) {
+                    buf.push_back(std::forward<V>(v));
+                    if (buf.size() < n) return;
+                    next(static_cast<const std::vector<In> &>(buf));
+                    buf.clear();
+                }
+            };
+        };
+
+        /* 按到达顺序与另一个话题的消息一一配对，输出std::pair。
+         * 每一侧最多缓冲depth个未配对的消息，超过时丢弃最旧的。需要按时间戳配对时使用TimeSynchronizer。
+         */
+        template<class Sub>
+        struct Zip : public Stage {
+            Sub sub;
+            std::size_t depth;
+
+            template<class In>
+            struct State {
+                using Other = typename Sub::ValType;
+                using Out = std::pair<In, Other>;
+                Sub sub;
+                std::size_t depth;
+                std::deque<In> left;
+                std::deque<Other> right;
+
+                explicit State(Zip &&z) : sub(std::move(z.sub)), depth(std::max<std::size_t>(z.depth, 1)) {}
+
+                template<class V, class Next>
+                void operator()(V &&v, Next &&next) {
+                    if (right.empty()) {
+                        if (left.size() >= depth) left.pop_front();
+                        left.emplace_back(std::forward<V>(v));
+                        return;
+                    }
+                    next(Out(std::forward<V>(v), std::move(right.front())));
+                    right.pop_front();
+                }
+
+                // 另一个话题的消息。
+                template<class Next>
+                void side(const Other &v, Next &&next) {
+                    if (left.empty()) {
+                        if (right.size() >= depth) right.pop_front();
+                        right.push_back(v);
+                        return;
+                    }
+                    next(Out(std::move(left.front()), v));
+                    left.pop_front();
+                }
+            };
+        };
+
+        template<class F>
+        inline Map<std::decay_t<F>> map(F &&f) { return {{}, std::forward<F>(f)}; }
+
+        template<class P>
+        inline Filter<std::decay_t<P>> filter(P &&p) { return {{}, std::forward<P>(p)}; }
+
+        inline Window window(std::size_t n) { return {{}, n}; }
+
+        template<class Sub>
+        inline Zip<std::decay_t<Sub>> zip(Sub &&sub, std::size_t depth = TOS_DYNAMIC_SIZE_DEFAULT) {
+            return {{}, std::forward<Sub>(sub), depth};
+        }
+
+        // 依次执行的若干算子。
+        template<class ...Ss>
+        struct Chain {
+            std::tuple<Ss...> stages;
+        };
+
+        template<class T>
+        constexpr bool isChain = false;
+
+        template<class ...Ss>
+        constexpr bool isChain<Chain<Ss...>> = true;
+
+        template<class T>
+        constexpr bool isChainable = isStage<T> || isChain<std::decay_t<T>>;
+
+        template<class T>
+        inline auto as_chain(T &&t) {
+            if constexpr(isStage<T>) return Chain<std::decay_t<T>>{std::tuple<std::decay_t<T>>(std::forward<T>(t))};
+            else return std::forward<T>(t);
+        }
+
+        template<class A, class B>
+        inline auto concat(A &&a, B &&b) {
+            auto ca = as_chain(std::forward<A>(a));
+            auto cb = as_chain(std::forward<B>(b));
+            auto t = std::tuple_cat(std::move(ca.stages), std::move(cb.stages));
+            return std::apply([](auto &&...s) { return Chain<std::decay_t<decltype(s)>...>{{std::move(s)...}}; },
+                              std::move(t));
+        }
+
+        // 已指定输入话题的算子链。
+        template<class Sub, class C>
+        struct Source {
+            Sub sub;
+            C chain;
+        };
+
+        // 已指定输出话题的算子链。
+        template<class C, class Pub>
+        struct Sink {
+            C chain;
+            Pub pub;
+        };
+
+        // 由输入类型依次得到各算子的状态类型。
+        template<class In, class ...Ss>
+        struct Bind {
+            using States = std::tuple<>;
+            using Out = In;
+        };
+
+        template<class In, class S, class ...Rest>
+        struct Bind<In, S, Rest...> {
+            using State = typename S::template State<In>;
+            using Next = Bind<typename State::Out, Rest...>;
+            using States = decltype(std::tuple_cat(std::declval<std::tuple<State>>(),
+                                                   std::declval<typename Next::States>()));
+            using Out = typename Next::Out;
+        };
+
+        template<class T>
+        constexpr bool hasSide = false;
+
+        template<class Sub>
+        constexpr bool hasSide<Zip<Sub>> = true;
+    }
+
+    /* 运行中的数据流，析构时停止处理。
+     * Sub: 输入话题的订阅器类型
+     * Pub: 输出话题的发布器类型
+     * Ss: 各算子类型
+     */
+    template<class Sub, class Pub, class ...Ss>
+    class Flow {
+    private:
+        using In = typename Sub::ValType;
+        using Bound = flow::Bind<In, Ss...>;
+        using States = typename Bound::States;
+        static constexpr std::size_t N = sizeof...(Ss);
+
+        static_assert(std::is_constructible_v<typename Pub::ValType, typename Bound::Out>,
+                      "flow output must be convertible to the output topic.");
+
+        // 回调持有Impl，停止时注销订阅者以解除持有；注销前到达的消息由running拒绝处理。
+        struct Impl {
+            std::mutex mtx;
+            bool running{true};
+            States states;
+            Pub pub;
+            Sub sub;
+
+            template<std::size_t ...Is>
+            Impl(Sub &&s, std::tuple<Ss...> &&specs, Pub &&p, std::index_sequence<Is...>) :
+                    states(std::tuple_element_t<Is, States>(std::move(std::get<Is>(specs)))...),
+                    pub(std::move(p)), sub(std::move(s)) {}
+
+            template<std::size_t I, class V>
+            void run(V &&v) {
+                if constexpr(I == N) {
+                    using Val = typename Pub::ValType;
+                    if constexpr(std::is_same_v<std::decay_t<V>, Val>) pub.push(std::forward<V>(v));
+                    else pub.push(Val(std::forward<V>(v)));
+                } else {
+                    std::get<I>(states)(std::forward<V>(v), [this](auto &&out) {
+                        run<I + 1>(std::forward<decltype(out)>(out));
+                    });
+                }
+            }
+
+            void feed(const In &v) {
+                std::unique_lock lock(mtx);
+                if (running) run<0>(v);
+            }
+
+            template<std::size_t I, class V>
+            void feed_side(const V &v) {
+                std::unique_lock lock(mtx);
+                if (!running) return;
+                std::get<I>(states).side(v, [this](auto &&out) { run<I + 1>(std::forward<decltype(out)>(out)); });
+            }
+
+            template<std::size_t I>
+            void attach(const std::shared_ptr<Impl> &self) {
+                using S = std::tuple_element_t<I, std::tuple<Ss...>>;
+                if constexpr(flow::hasSide<S>) {
+                    using V = typename std::tuple_element_t<I, States>::Other;
+                    auto &side = std::get<I>(states);
+                    side.sub.set_inline_callback([self](const V &v) { self->template feed_side<I>(v); });
+                    drain(side.sub, [this](const V &v) {
+                        std::get<I>(states).side(v, [this](auto &&out) { run<I + 1>(std::forward<decltype(out)>(out)); });
+                    });
+                }
+            }
+
+            template<std::size_t I>
+            void detach() {
+                using S = std::tuple_element_t<I, std::tuple<Ss...>>;
+                if constexpr(flow::hasSide<S>) std::get<I>(states).sub.reset();
+            }
+
+            /* 取出设置回调前已放入订阅者容器的消息，如订阅时补发的锁存消息，需持有mtx。
+             * 之后到达的消息直接调用回调，回调等待mtx，因此不会先于这些消息处理。
+             */
+            template<class S, class F>
+            static void drain(S &s, F &&f) {
+                typename S::ValType v;
+                while (s.pop(v, std::chrono::nanoseconds(0)) == MessageStatus::OK) f(v);
+            }
+
+            template<std::size_t ...Is>
+            void start(const std::shared_ptr<Impl> &self, std::index_sequence<Is...>) {
+                std::unique_lock lock(mtx);
+                (attach<Is>(self), ...);
+                sub.set_inline_callback([self](const In &v) { self->feed(v); });
+                drain(sub, [this](const In &v) { run<0>(v); });
+            }
+
+            /* 注销订阅者以解除回调对Impl的持有。
+             * 注销会等待正在进行的回调返回，回调需要mtx，因此在锁外注销。
+             */
+            template<std::size_t ...Is>
+            void stop(std::index_sequence<Is...>) {
+                {
+                    std::unique_lock lock(mtx);
+                    running = false;
+                }
+                sub.reset();
+                (detach<Is>(), ...);
+                pub.reset();
+            }
+        };
+
+        std::shared_ptr<Impl> impl;
+
+    public:
+        Flow() = default;
+
+        Flow(Sub &&sub, std::tuple<Ss...> &&stages, Pub &&pub) :
+                impl(std::make_shared<Impl>(std::move(sub), std::move(stages), std::move(pub),
+                                            std::index_sequence_for<Ss...>())) {
+            impl->start(impl, std::index_sequence_for<Ss...>());
+        }
+
+        ~Flow() {
+            stop();
+        }
+
+        Flow(const Flow &) = delete;
+
+        Flow(Flow &&) = default;
+
+        Flow &operator=(const Flow &) = delete;
+
+        Flow &operator=(Flow &&f) {
+            stop();
+            impl = std::move(f.impl);
+            return *this;
+        }
+
+        operator bool() const { return impl != nullptr; }
+
+        // 停止处理，之后到达的消息被丢弃。
+        void stop() {
+            if (!impl) return;
+            impl->stop(std::index_sequence_for<Ss...>());
+            impl.reset();
+        }
+    };
+
+    namespace flow {
+        template<class Sub, class Pub, class ...Ss>
+        inline Flow<Sub, Pub, Ss...> make_flow(Sub &&sub, Chain<Ss...> &&chain, Pub &&pub) {
+            return Flow<Sub, Pub, Ss...>(std::move(sub), std::move(chain.stages), std::move(pub));
+        }
+
+        // 算子 | 算子
+        template<class A, class B, class = std::enable_if_t<isChainable<A> && isChainable<B>>>
+        inline auto operator|(A &&a, B &&b) { return concat(std::forward<A>(a), std::forward<B>(b)); }
+
+        // 订阅器 | 算子
+        template<class M, class B, class = std::enable_if_t<isChainable<B>>>
+        inline auto operator|(Subscriber<M> &&sub, B &&b) {
+            using C = decltype(as_chain(std::forward<B>(b)));
+            return Source<Subscriber<M>, C>{std::move(sub), as_chain(std::forward<B>(b))};
+        }
+
+        template<class Sub, class C, class B, class = std::enable_if_t<isChainable<B>>>
+        inline auto operator|(Source<Sub, C> &&src, B &&b) {
+            using D = decltype(concat(std::move(src.chain), std::forward<B>(b)));
+            return Source<Sub, D>{std::move(src.sub), concat(std::move(src.chain), std::forward<B>(b))};
+        }
+
+        // 算子 >> 发布器，>>的优先级高于|，因此a | f >> b中先得到Sink。
+        template<class A, class M, class = std::enable_if_t<isChainable<A>>>
+        inline auto operator>>(A &&a, Publisher<M> &&pub) {
+            using C = decltype(as_chain(std::forward<A>(a)));
+            return Sink<C, Publisher<M>>{as_chain(std::forward<A>(a)), std::move(pub)};
+        }
+
+        template<class Sub, class C, class M>
+        inline auto operator>>(Source<Sub, C> &&src, Publisher<M> &&pub) {
+            return make_flow(std::move(src.sub), std::move(src.chain), std::move(pub));
+        }
+
+        template<class M, class C, class Pub>
+        inline auto operator|(Subscriber<M> &&sub, Sink<C, Pub> &&sink) {
+            return make_flow(std::move(sub), std::move(sink.chain), std::move(sink.pub));
+        }
+
+        template<class Sub, class C, class D, class Pub>
+        inline auto operator|(Source<Sub, C> &&src, Sink<D, Pub> &&sink) {
+            return make_flow(std::move(src.sub), concat(std::move(src.chain), std::move(sink.chain)),
+                             std::move(sink.pub));
+        }
+    }
+}
+
+#endif /* TOS_FLOW_H */
@@ -5,14 +5,28 @@
 #ifndef TOS_MESSAGE_H
 #define TOS_MESSAGE_H
 
-#include "../utils/CircularQueue.h"
-#include "../utils/Stack.h"
+#include "AQM.h"
 #include "Container.h"
+#include "Envelope.h"
 #include "ObjManager.h"
+#include "RawMessage.h"
+#include "Serialize.h"
 #include <list>
+#include <vector>
+#include <atomic>
 #include <mutex>
+#include <cstdint>
+#include <cstring>
+#include <typeinfo>
+#include <new>
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <optional>
+#include <thread>
 
 namespace tOS {
     // 消息发布器
@@ -24,35 +38,107 @@ namespace tOS {
     class Subscriber;
 
     enum class MessageStatus {
-        OK = 0,     // 正常
-        TIMEOUT,    // 超时
-        EMPTY       // 消息无发布者
+        OK = 0,         // 正常
+        TIMEOUT,        // 超时
+        EMPTY,          // 消息无发布者
+        DISCONNECTED    // 订阅者因持续溢出被断开
     };
 
-    /* 单出口消息，默认消息容器满时会覆盖未取走的数据
+    /* 订阅者容器满时的处理方式
+     * KEEP_LAST: 丢弃最旧的消息，只保留最新的消息，并累计丢弃数
+     * RELIABLE: 发布者阻塞等待订阅者取走消息，超时后按KEEP_LAST处理
+     * DISCONNECT: 按KEEP_LAST处理，连续溢出达到上限后断开该订阅者，不再向其复制消息
+     */
+    enum class QoSPolicy {
+        KEEP_LAST = 0, RELIABLE, DISCONNECT
+    };
+
+    // 订阅者服务质量，仅对MultiMessage有效。
+    struct SubscriberQoS {
+        QoSPolicy policy{QoSPolicy::KEEP_LAST};
+        // RELIABLE时发布者最长的阻塞时间
+        std::chrono::nanoseconds timeout{std::chrono::milliseconds(100)};
+        // DISCONNECT时允许的最大连续溢出次数
+        std::size_t max_overrun{16};
+    };
+
+    /* 订阅需求：消息上订阅者的个数，以及订阅者出现或消失时对发布者的通知，用于发布者按需生产。
+     * 个数为原子变量，可以在锁外读取；修改、等待和注册回调需持有消息的锁。
+     */
+    class Demand {
+    public:
+        using Callback = std::function<void(std::size_t)>;
+        using w_iter = std::list<Callback>::iterator;
+    private:
+        std::atomic_size_t num{0};
+        std::condition_variable cv;
+        std::list<Callback> callbacks;
+
+        void notify() {
+            std::size_t n = num;
+            for (auto &f: callbacks) f(n);
+            cv.notify_all();
+        }
+
+    public:
+        inline std::size_t get() const { return num; }
+
+        void attach() {
+            num++;
+            notify();
+        }
+
+        void detach() {
+            num--;
+            notify();
+        }
+
+        // 注册回调，并立即以当前的订阅者个数调用一次。
+        w_iter watch(Callback &&f) {
+            callbacks.push_front(std::move(f));
+            callbacks.front()(num);
+            return callbacks.begin();
+        }
+
+        void unwatch(const w_iter &iter) { callbacks.erase(iter); }
+
+        // 等待直到有订阅者，until为nullptr时一直等待，返回是否有订阅者。
+        bool wait(std::unique_lock<std::mutex> &lock, const std::chrono::steady_clock::time_point *until) {
+            auto ready = [this]() { return num > 0; };
+            if (until == nullptr) {
+                cv.wait(lock, ready);
+                return true;
+            }
+            return cv.wait_until(lock, *until, ready);
+        }
+    };
+
+    /* 单出口消息，默认消息容器满时会覆盖未取走的数据，可以开启AQM丢弃排队过久的消息
      * 即同一消息仅可被不同订阅者中的某一位获取
      * T: 消息元素类型
-     * size: 消息容量
-     * Container: 消息容器，也即消息传递方式。包括循环队列和栈
+     * size: 消息容量，为DYNAMIC_SIZE时在创建时指定
+     * Container: 消息容器，也即消息传递方式。包括循环队列、栈、优先队列、截止时间队列和合并队列
      */
     template<class T, std::size_t SIZE = 1, ContainerEnum Container = CIRCULAR_QUEUE>
     class SingleMessage {
-        static_assert(SIZE > 0, "size must larger than 1.");
-        static_assert(Container == CIRCULAR_QUEUE || CIRCULAR_QUEUE == STACK,
-                      "Container must be either CIRCULAR_QUEUE or STACK.");
+        static_assert(isContainerEnum<Container>, "Container must be one of ContainerEnum.");
         friend Publisher<SingleMessage>;
         friend Subscriber<SingleMessage>;
         friend SharedObj<SingleMessage>;
     private:
         using ValType = T;
-        using C = std::conditional_t<Container == CIRCULAR_QUEUE,
-                CircularQueue<T, SIZE, false>, Stack<T, SIZE, false>>;
+        // 优先级和截止时间只取决于消息元素T。
+        using C = ContainerType<Stamped<T>, SIZE, Container, StampedKey<KeyIdentity>>;
         // 所有接收者对应同一个容器。
         C c;
+        // 主动队列管理
+        CoDel aqm;
+        // 信封的序号
+        std::uint64_t seq{0};
         // 该消息上的发布者的个数
-        std::size_t publisher_ref{0};
-        // 该消息上的订阅者的个数
-        std::size_t subscriber_ref{0};
+        std::atomic_size_t publisher_ref{0};
+        // 该消息上的订阅者的个数及其变化的通知
+        Demand demand;
         // 用于线程同步
         std::mutex mtx;
         std::condition_variable cv;
@@ -63,6 +149,8 @@ namespace tOS {
         // 私有构造使得该类不能被直接创建。
         SingleMessage() = default;
 
+        SingleMessage(std::size_t capacity, std::size_t max_capacity) : c(capacity, max_capacity) {}
+
         p_iter attach_publisher() {
             std::unique_lock lock(mtx);
             publisher_ref++;
@@ -76,52 +164,118 @@ namespace tOS {
 
         s_iter attach_subscriber() {
             std::unique_lock lock(mtx);
-            subscriber_ref++;
+            demand.attach();
             return Empty();
         }
 
         void detach_subscriber(const s_iter &iter) {
             std::unique_lock lock(mtx);
-            subscriber_ref--;
+            demand.detach();
         }
 
-        void push(const p_iter &iter, const T &obj) {
+        Demand::w_iter watch_demand(Demand::Callback &&f) {
             std::unique_lock lock(mtx);
-            if (c.full()) c.pop();
-            c.push(obj);
+            return demand.watch(std::move(f));
+        }
+
+        void unwatch_demand(const Demand::w_iter &iter) {
+            std::unique_lock lock(mtx);
+            demand.unwatch(iter);
+        }
+
+        bool wait_demand(const std::chrono::steady_clock::time_point *until) {
+            std::unique_lock lock(mtx);
+            return demand.wait(lock, until);
+        }
+
+        void set_aqm(const AQMPolicy &policy) {
+            std::unique_lock lock(mtx);
+            aqm.set_policy(policy);
+        }
+
+        AQMStat get_aqm_stat() {
+            std::unique_lock lock(mtx);
+            return aqm.get_stat();
+        }
+
+        std::size_t get_conflated_num(const s_iter &iter) {
+            std::unique_lock lock(mtx);
+            return c.get_conflated_num();
+        }
+
+        // 由args在容器中原地构造带时间戳的元素，需持有锁。
+        template<class ...Ts>
+        void put(Ts &&...args) {
+            if (!c.full()) {
+                c.emplace(aqm.stamp(), std::forward<Ts>(args)...);
+            } else if constexpr(isPriorityQueue<C> || isConflatingQueue<C>) {
+                // 需要先构造出元素，与已有元素比较优先级或键。
+                Stamped<T> s(aqm.stamp(), std::forward<Ts>(args)...);
+                if (overflow(c, &s)) {
+                    aqm.evicted();
+                    if (!evict(c, &s)) return;
+                }
+                c.push(std::move(s));
+            } else {
+                aqm.evicted();
+                evict(c, static_cast<const Stamped<T> *>(nullptr));
+                c.emplace(aqm.stamp(), std::forward<Ts>(args)...);
+            }
             cv.notify_one();
         }
 
+        // 取出一个未被AQM丢弃的元素，需持有锁且容器非空。
+        void take(T &obj) {
+            while (true) {
+                auto e = c.pop();
+                if (aqm.drop(e.stamp, c.empty())) continue;
+                obj = std::move(e.value);
+                return;
+            }
+        }
+
+        void push(const p_iter &iter, const T &obj) {
+            if constexpr(isEnvelope<T>) { // 信封需要在复制出的对象上填写。
+                push(iter, T(obj));
+                return;
+            }
+            std::unique_lock lock(mtx);
+            put(obj);
+        }
+
         void push(const p_iter &iter, T &&obj) {
             std::unique_lock lock(mtx);
-            if (c.full()) c.pop();
-            c.push(std::move(obj));
-            cv.notify_one();
+            if constexpr(isEnvelope<T>) seal(obj, ++seq);
+            put(std::move(obj));
         }
 
         template<class ...Ts>
         void emplace(const p_iter &iter, Ts &&...args) {
+            if constexpr(isEnvelope<T>) {
+                push(iter, T{std::forward<Ts>(args)...});
+                return;
+            }
             std::unique_lock lock(mtx);
-            if (c.full()) c.pop();
-            c.emplace(std::forward<Ts>(args)...);
-            cv.notify_one();
+            put(std::forward<Ts>(args)...);
         }
 
         MessageStatus pop(const s_iter &iter, T &obj) {
             std::unique_lock lock(mtx);
             cv.wait(lock, [this]() { return !c.empty() || publisher_ref == 0; });
             if (publisher_ref == 0) return MessageStatus::EMPTY;
-            obj = std::move(c.pop());
+            take(obj);
             return MessageStatus::OK;
         }
 
         template<typename _Rep, typename _Period>
         MessageStatus pop(const s_iter &iter, T &obj, const std::chrono::duration<_Rep, _Period> &dt) {
             std::unique_lock lock(mtx);
-            if (!cv.wait_for(lock, [this]() { return !c.empty() || publisher_ref == 0; }, dt))
+            auto ready = [this]() { return !c.empty() || publisher_ref == 0; };
+            // 不等待时直接返回，超时时间已到的定时等待仍会进入内核，耗时数十微秒。
+            if (!ready() && (dt <= dt.zero() || !cv.wait_for(lock, dt, ready)))
                 return MessageStatus::TIMEOUT;
             if (publisher_ref == 0) return MessageStatus::EMPTY;
-            obj = std::move(c.pop());
+            take(obj);
             return MessageStatus::OK;
         }
     };
@@ -133,40 +287,128 @@ namespace tOS {
     template<class T, std::size_t SIZE, ContainerEnum Container>
     constexpr bool isSingleMessage<SingleMessage<T, SIZE, Container>> = true;
 
-    /* 多出口消息，默认消息容器满时会覆盖未取走的数据
+    /* 多出口消息，默认消息容器满时会覆盖未取走的数据，每个订阅者可以单独设置容器满时的处理方式
      * 即同一消息可以被不同订阅者同时获取
+     * 开启锁存后保留最近发布的若干条消息，新订阅者创建时立即收到这些消息，适用于配置、地图等只发布一次的数据
      * T: 消息元素类型
-     * size: 消息容量。
-     * Container: 消息容器，也即消息传递方式。包括循环队列和栈
+     * size: 消息容量，为DYNAMIC_SIZE时在创建时指定。每个订阅者的容器在收到第一条消息时才分配内存
+     * Container: 消息容器，也即消息传递方式。包括循环队列、栈、优先队列、截止时间队列和合并队列
      */
     template<class T, std::size_t SIZE = 1, ContainerEnum Container = CIRCULAR_QUEUE>
-    class MultiMessage {
-        static_assert(SIZE > 0, "size must larger than 1.");
-        static_assert(Container == CIRCULAR_QUEUE || CIRCULAR_QUEUE == STACK,
-                      "Container must be either CIRCULAR_QUEUE or STACK.");
+    class MultiMessage : public RawMessage {
+        static_assert(isContainerEnum<Container>, "Container must be one of ContainerEnum.");
         friend Publisher<MultiMessage>;
         friend Subscriber<MultiMessage>;
         friend SharedObj<MultiMessage>;
     private:
         using ValType = T;
-        using C = std::conditional_t<Container == CIRCULAR_QUEUE,
-                CircularQueue<T, SIZE, false>, Stack<T, SIZE, false>>;
+        using C = ContainerType<T, SIZE, Container>;
+
+        /* 直接调用的回调及正在进行的调用数。发布者缓存其引用，
+         * 注销或更换回调时置closed并等待正在进行的调用返回，之后不会再被调用。
+         */
+        struct Direct {
+            std::function<void(const T &)> f;
+            std::atomic_size_t calls{0};
+            std::atomic_bool closed{false};
+        };
+
+        // 订阅者的容器及其服务质量状态
+        struct Entry {
+            C c;
+            SubscriberQoS qos;
+            // 因容器满而丢弃的消息数
+            std::size_t dropped{0};
+            // 连续溢出的次数
+            std::size_t overrun{0};
+            // 正在等待该订阅者腾出空间的发布者数
+            std::size_t waiting{0};
+            bool disconnected{false};
+            // 有发布者等待时注销的订阅者，由最后一个等待者移除。
+            bool detached{false};
+            // 内容过滤条件，为空时接收所有消息
+            std::function<bool(const T &)> filter;
+            // 限频时接收消息的最小间隔，为0时不限频，及下一次可以接收的时刻
+            std::chrono::nanoseconds period{0};
+            std::chrono::steady_clock::time_point next{};
+            // 被过滤或限频跳过的消息数
+            std::size_t filtered{0};
+            /* 回调式订阅者的回调及其所在线程，该线程上的发布者直接调用回调而不经过容器。
+             * owner为空时在所有发布者线程中直接调用。
+             */
+            std::shared_ptr<Direct> callback;
+            std::thread::id owner;
+            // pop的结果可能改变时的通知（收到消息、被断开或没有发布者），在锁内调用
+            std::function<void()> notify;
+            // 订阅者的标识，在该消息上不会复用，Local据此跳过已直接调用的订阅者
+            std::uint64_t id{0};
+
+            template<class ...Ts>
+            explicit Entry(Ts &&...args) : c(std::forward<Ts>(args)...) {}
+        };
+
+        /* 发布线程缓存的本线程上的回调式订阅者，版本号与消息一致时无需加锁即可使用。
+         * 每个线程对每个消息各有一份，因此同一个发布者仍可以在多个线程中同时发布。
+         * 有其他订阅者、监听器或开启锁存时仍需加锁发布，但跳过已直接调用的订阅者。
+         */
+        struct Local {
+            // 所属消息的标识，及其存活标记，消息销毁后的Local在之后创建新Local时清除
+            std::uint64_t id{0};
+            std::weak_ptr<void> alive;
+            std::uint64_t version{0};
+            std::vector<std::shared_ptr<Direct>> direct;
+            /* 直接调用的订阅者的标识，加锁发布时跳过。
+             * 不使用地址：Local可能已过期，注销的订阅者的内存可能被新订阅者复用。
+             */
+            std::vector<std::uint64_t> skip;
+            bool queued{true};
+        };
+
         // 每个接收者单独对应一个容器。
-        std::list<C> cs;
+        std::list<Entry> cs;
+        // 原始数据监听器，如录制服务。
+        std::vector<RawTap *> taps;
+        // 序列化缓冲区，避免每条消息重新分配内存。
+        std::vector<unsigned char> raw_buf;
+        // 新订阅者容器的容量
+        Capacity cap{SIZE, SIZE};
+        // 已创建的订阅者个数，用于分配订阅者的标识
+        std::uint64_t entry_count{0};
+        // 锁存的最近若干条消息，及锁存的条数，为0时不锁存
+        std::deque<T> latched;
+        std::size_t latch_depth{0};
+        // 设置了过滤条件的订阅者个数，不为0时emplace需要先构造出完整的对象
+        std::size_t filter_ref{0};
+        /* RELIABLE订阅者个数，不为0时emplace也需要先构造出完整的对象：
+         * 投递时可能在等待空位时释放锁，期间其他订阅者可能设置过滤条件。
+         */
+        std::size_t reliable_ref{0};
+        // 信封的序号，放入容器的消息在锁内递增，只有直接调用时在锁外递增
+        std::atomic_uint64_t seq{0};
+        // 订阅者、监听器或锁存变化时递增，发布线程据此更新Local，从1开始
+        std::atomic_uint64_t version{1};
+        // 消息的标识，不会被之后创建的同类型消息复用，用于在线程的Local缓存中查找
+        inline static std::atomic_uint64_t id_count{0};
+        const std::uint64_t id{++id_count};
+        std::shared_ptr<char> alive{std::make_shared<char>()};
         // 该消息上的发布者的个数
-        std::size_t publisher_ref{0};
-        // 该消息上的订阅者的个数
-        std::size_t subscriber_ref{0};
+        std::atomic_size_t publisher_ref{0};
+        // 该消息上的订阅者的个数及其变化的通知
+        Demand demand;
         // 用于线程同步
         std::mutex mtx;
         std::condition_variable cv;
+        // 用于RELIABLE订阅者通知发布者容器有空位
+        std::condition_variable space_cv;
 
-        using s_iter = typename std::list<C>::iterator;
+        using s_iter = typename std::list<Entry>::iterator;
         using p_iter = Empty;
 
         // 私有构造使得该类不能被直接创建。
         MultiMessage() = default;
 
+        MultiMessage(std::size_t capacity, std::size_t max_capacity) : cap{capacity, max_capacity} {}
+
         p_iter attach_publisher() {
             std::unique_lock lock(mtx);
             publisher_ref++;
@@ -175,66 +417,464 @@ namespace tOS {
 
         void detach_publisher(const p_iter &iter) {
             std::unique_lock lock(mtx);
-            if (--publisher_ref == 0) cv.notify_all();
+            if (--publisher_ref == 0) {
+                cv.notify_all();
+                for (auto &e: cs) if (e.notify) e.notify();
+            }
         }
 
         s_iter attach_subscriber() {
             std::unique_lock lock(mtx);
-            subscriber_ref++;
-            cs.emplace_front();
+            if constexpr(SIZE == DYNAMIC_SIZE) cs.emplace_front(cap.capacity, cap.max_capacity);
+            else cs.emplace_front();
+            cs.front().id = ++entry_count;
+            // 在锁内补发锁存的消息，不会与之后发布的消息交错。
+            auto &c = cs.front().c;
+            for (auto &obj: latched) {
+                if (overflow(c, &obj) && !evict(c, &obj)) continue;
+                c.push(obj);
+            }
+            version++;
+            demand.attach();
             return cs.begin();
         }
 
+        // 移除订阅者并更新计数，需持有锁。
+        s_iter erase(const s_iter &iter) {
+            if (iter->filter) filter_ref--;
+            if (iter->qos.policy == QoSPolicy::RELIABLE) reliable_ref--;
+            return cs.erase(iter);
+        }
+
+        /* 停止直接调用回调d，并等待其他线程中正在进行的调用返回，需持有锁。
+         * 等待时释放锁：回调中可能加锁发布该消息。
+         */
+        void close(std::unique_lock<std::mutex> &lock, std::shared_ptr<Direct> d) {
+            if (!d) return;
+            d->closed = true;
+            version++;
+            lock.unlock();
+            while (d->calls.load() > 0) std::this_thread::yield();
+            lock.lock();
+        }
+
         void detach_subscriber(const s_iter &iter) {
             std::unique_lock lock(mtx);
-            cs.erase(iter);
-            subscriber_ref--;
+            close(lock, iter->callback);
+            if (iter->waiting > 0) {
+                iter->detached = true;
+                space_cv.notify_all();
+            } else {
+                erase(iter);
+            }
+            version++;
+            demand.detach();
         }
 
-        void push(const p_iter &iter, const T &obj) {
+        Demand::w_iter watch_demand(Demand::Callback &&f) {
+            std::unique_lock lock(mtx);
+            return demand.watch(std::move(f));
+        }
+
+        void unwatch_demand(const Demand::w_iter &iter) {
+            std::unique_lock lock(mtx);
+            demand.unwatch(iter);
+        }
+
+        bool wait_demand(const std::chrono::steady_clock::time_point *until) {
+            std::unique_lock lock(mtx);
+            return demand.wait(lock, until);
+        }
+
+        void set_qos(const s_iter &iter, const SubscriberQoS &qos) {
+            std::unique_lock lock(mtx);
+            if (iter->qos.policy == QoSPolicy::RELIABLE) reliable_ref--;
+            iter->qos = qos;
+            if (iter->qos.policy == QoSPolicy::RELIABLE) reliable_ref++;
+            iter->overrun = 0;
+            iter->disconnected = false;
+            version++;
+            space_cv.notify_all();
+        }
+
+        std::size_t get_drop_num(const s_iter &iter) {
+            std::unique_lock lock(mtx);
+            return iter->dropped;
+        }
+
+        void set_filter(const s_iter &iter, std::function<bool(const T &)> &&filter) {
+            std::unique_lock lock(mtx);
+            if (iter->filter) filter_ref--;
+            iter->filter = std::move(filter);
+            if (iter->filter) filter_ref++;
+            version++;
+        }
+
+        void set_max_rate(const s_iter &iter, double hz) {
+            std::unique_lock lock(mtx);
+            iter->period = hz > 0 ? std::chrono::nanoseconds(static_cast<std::int64_t>(1e9 / hz))
+                                  : std::chrono::nanoseconds(0);
+            iter->next = {};
+            version++;
+        }
+
+        // any_thread: 是否在所有发布者线程中直接调用，否则只在当前线程中直接调用。
+        void set_callback(const s_iter &iter, std::function<void(const T &)> &&callback, bool any_thread) {
+            std::unique_lock lock(mtx);
+            close(lock, iter->callback);
+            auto d = std::make_shared<Direct>();
+            d->f = std::move(callback);
+            iter->callback = std::move(d);
+            iter->owner = any_thread ? std::thread::id() : std::this_thread::get_id();
+            version++;
+        }
+
+        void set_notify(const s_iter &iter, std::function<void()> &&notify) {
             std::unique_lock lock(mtx);
-            for (auto &v: cs) {
-                if (v.full()) v.pop();
-                v.push(obj);
+            iter->notify = std::move(notify);
+        }
+
+        // 调用订阅者的回调，只在订阅者所在线程调用，无需加锁。
+        static void invoke(const s_iter &iter, const T &obj) {
+            iter->callback->f(obj);
+        }
+
+        std::size_t get_filtered_num(const s_iter &iter) {
+            std::unique_lock lock(mtx);
+            return iter->filtered;
+        }
+
+        std::size_t get_conflated_num(const s_iter &iter) {
+            std::unique_lock lock(mtx);
+            return iter->c.get_conflated_num();
+        }
+
+        /* 订阅者是否接收该消息，需持有锁。
+         * obj: 消息，为nullptr时表示没有订阅者设置过滤条件，且没有RELIABLE订阅者，投递过程中不会释放锁
+         * now: 当前时刻，首次需要时获取
+         */
+        static bool accept(Entry &e, const T *obj, std::chrono::steady_clock::time_point &now) {
+            if (e.filter && !e.filter(*obj)) {
+                e.filtered++;
+                return false;
             }
-            cv.notify_all();
+            if (e.period.count() == 0) return true;
+            if (now == std::chrono::steady_clock::time_point{}) now = std::chrono::steady_clock::now();
+            if (now < e.next) {
+                e.filtered++;
+                return false;
+            }
+            // 未落后一个间隔以上时保持相位，使实际频率接近设定值。
+            e.next = now - e.next < e.period ? e.next + e.period : now + e.period;
+            return true;
         }
 
-        void push(const p_iter &iter, T &&obj) {
+        void set_latch(std::size_t depth) {
             std::unique_lock lock(mtx);
-            for (auto &v: cs) {
-                if (v.full()) v.pop();
-                v.push(std::move(obj));
+            latch_depth = depth;
+            while (latched.size() > latch_depth) latched.pop_front();
+            version++;
+        }
+
+        // 保存一份消息用于锁存，需持有锁。
+        void latch(const T &obj) {
+            if (latch_depth == 0) return;
+            if (latched.size() >= latch_depth) latched.pop_front();
+            latched.push_back(obj);
+        }
+
+        /* 将消息放入每个接收该消息的订阅者的容器，需持有锁。
+         * obj: 用于过滤、合并和比较优先级的消息，没有订阅者设置过滤条件且不是合并队列或优先队列时可以为nullptr
+         * put(c, last): 放入容器c，last表示是否为最后一个容器，此时可以移动消息。
+         * skip: 已经直接调用过的订阅者
+         */
+        template<class F>
+        void deliver(std::unique_lock<std::mutex> &lock, const T *obj, F &&put, const Local *skip = nullptr) {
+            std::chrono::steady_clock::time_point now{};
+            for (auto it = cs.begin(); it != cs.end();) {
+                auto &e = *it;
+                if (skip != nullptr && std::find(skip->skip.begin(), skip->skip.end(), e.id) != skip->skip.end()) {
+                    ++it;
+                    continue;
+                }
+                // 在复制之前过滤，不接收的订阅者没有额外开销。
+                if (e.detached || e.disconnected || !accept(e, obj, now)) {
+                    ++it;
+                    continue;
+                }
+                if (overflow(e.c, obj) && e.qos.policy == QoSPolicy::RELIABLE) {
+                    e.waiting++;
+                    space_cv.wait_for(lock, e.qos.timeout, [&e, obj]() { return !overflow(e.c, obj) || e.detached; });
+                    if (--e.waiting == 0 && e.detached) {
+                        it = erase(it);
+                        continue;
+                    }
+                }
+                if (e.detached || e.disconnected) {
+                    ++it;
+                    continue;
+                }
+                if (!overflow(e.c, obj)) {
+                    e.overrun = 0;
+                } else if (e.qos.policy == QoSPolicy::DISCONNECT && ++e.overrun >= e.qos.max_overrun) {
+                    // 断开后释放积压的消息，订阅者pop时得到DISCONNECTED。
+                    e.disconnected = true;
+                    while (!e.c.empty()) e.c.pop();
+                    if (e.notify) e.notify();
+                    ++it;
+                    continue;
+                } else {
+                    e.dropped++;
+                    // 优先队列中新消息不比已有消息更优先时，丢弃新消息。
+                    if (!evict(e.c, obj)) {
+                        ++it;
+                        continue;
+                    }
+                }
+                ++it;
+                put(e.c, it == cs.end());
+                if (e.notify) e.notify();
             }
             cv.notify_all();
         }
 
+        // 将消息的二进制表示交给监听器，需持有锁。
+        void tap(const T &obj) {
+            if (taps.empty()) return;
+            if constexpr(std::is_trivially_copyable_v<T>) {
+                for (auto *t: taps) t->on_raw(&obj, sizeof(T));
+            } else if constexpr(isSerializable<T>) {
+                raw_buf.clear();
+                serialize(obj, raw_buf);
+                for (auto *t: taps) t->on_raw(raw_buf.data(), raw_buf.size());
+            }
+        }
+
+        void push(const p_iter &iter, const T &obj) {
+            if constexpr(isEnvelope<T>) { // 信封需要在复制出的对象上填写。
+                push(iter, T(obj));
+                return;
+            }
+            std::unique_lock lock(mtx);
+            tap(obj);
+            latch(obj);
+            deliver(lock, &obj, [&obj](C &c, bool last) { c.push(obj); });
+        }
+
+        void push(const p_iter &iter, T &&obj) {
+            std::unique_lock lock(mtx);
+            if constexpr(isEnvelope<T>) seal(obj, ++seq);
+            tap(obj);
+            latch(obj);
+            deliver(lock, &obj, [&obj](C &c, bool last) {
+                if (last) c.push(std::move(obj));
+                else c.push(obj);
+            });
+        }
+
         template<class ...Ts>
         void emplace(const p_iter &iter, Ts &&...args) {
             std::unique_lock lock(mtx);
-            for (auto &c: cs) {
-                if (c.full()) c.pop();
-                c.emplace(std::forward<Ts>(args)...);
+            // 信封、合并队列、优先队列、有监听器、开启锁存、有订阅者设置过滤条件或有RELIABLE订阅者时需要先构造出完整的对象。
+            if (isEnvelope<T> || Container == CONFLATE || isPriorityQueue<C> || !taps.empty() || latch_depth > 0 ||
+                filter_ref > 0 || reliable_ref > 0) {
+                lock.unlock();
+                push(iter, T{std::forward<Ts>(args)...});
+                return;
             }
-            cv.notify_all();
+            deliver(lock, nullptr, [&args...](C &c, bool last) {
+                if (last) c.emplace(std::forward<Ts>(args)...);
+                else c.emplace(args...);
+            });
         }
 
-        MessageStatus pop(const s_iter &iter, T &obj) {
+        // 重新收集本线程上可以直接调用的订阅者，设置了过滤条件或限频的订阅者仍经过容器。
+        void refresh(Local &l) {
             std::unique_lock lock(mtx);
-            cv.wait(lock, [this, &iter]() { return !iter->empty() || publisher_ref == 0; });
-            if (publisher_ref == 0) return MessageStatus::EMPTY;
-            obj = std::move(iter->pop());
+            auto thread = std::this_thread::get_id();
+            l.version = version;
+            l.direct.clear();
+            l.skip.clear();
+            l.queued = !taps.empty() || latch_depth > 0;
+            for (auto &e: cs) {
+                if (e.detached || e.disconnected) continue;
+                if (e.callback && !e.callback->closed && (e.owner == thread || e.owner == std::thread::id()) && !e.filter &&
+                    e.period.count() == 0) {
+                    l.direct.push_back(e.callback);
+                    l.skip.push_back(e.id);
+                } else {
+                    l.queued = true;
+                }
+            }
+        }
+
+        /* 本线程上该消息的Local，不存在时创建，过期时更新。
+         * 以链表存放，回调中经其他消息发布而创建新Local时，已取得的引用仍然有效。
+         */
+        Local &local() {
+            thread_local std::list<Local> locals;
+            for (auto &l: locals) {
+                if (l.id != id) continue;
+                if (l.version != version.load(std::memory_order_acquire)) refresh(l);
+                return l;
+            }
+            // 清除已销毁的消息的Local，释放其持有的回调。
+            locals.remove_if([](const Local &l) { return l.alive.expired(); });
+            auto &l = locals.emplace_front();
+            l.id = id;
+            l.alive = alive;
+            refresh(l);
+            return l;
+        }
+
+        // 本线程上是否有可以直接调用的订阅者。
+        inline bool has_direct() {
+            return !local().direct.empty();
+        }
+
+        /* 直接调用本线程上的订阅者。回调中可能经同一发布者再次发布而更新l，因此按下标遍历。
+         * 调用进行中订阅者不会注销，Entry持有回调，因此只需取得裸指针。
+         */
+        static void call_direct(const Local &l, const T &obj) {
+            struct Call {
+                Direct *d;
+                ~Call() { d->calls.fetch_sub(1, std::memory_order_release); }
+            };
+            for (std::size_t i = 0; i < l.direct.size(); i++) {
+                Call call{l.direct[i].get()};
+                // 先计数再检查closed，与close的先置closed再检查计数配对，两者至少有一方看到对方。
+                call.d->calls.fetch_add(1);
+                if (!call.d->closed.load()) call.d->f(obj);
+            }
+        }
+
+        /* 带本线程直接调用的发布：在发布者线程中直接调用本线程上的回调式订阅者，不加锁也不复制，
+         * 并加锁将消息放入其余订阅者的容器。没有其余订阅者、监听器和锁存时完全不加锁。
+         * 信封先在锁内分配序号并放入容器，再直接调用，保证每个容器中的序号递增。
+         */
+        void publish(const p_iter &iter, const T &obj) {
+            auto &l = local();
+            if (l.direct.empty()) {
+                push(iter, obj);
+            } else if constexpr(isEnvelope<T>) { // 信封需要在复制出的对象上填写。
+                publish(iter, T(obj));
+            } else {
+                call_direct(l, obj);
+                if (!l.queued) return;
+                std::unique_lock lock(mtx);
+                tap(obj);
+                latch(obj);
+                deliver(lock, &obj, [&obj](C &c, bool last) { c.push(obj); }, &l);
+            }
+        }
+
+        void publish(const p_iter &iter, T &&obj) {
+            auto &l = local();
+            if (l.direct.empty()) {
+                push(iter, std::move(obj));
+                return;
+            }
+            if constexpr(isEnvelope<T>) {
+                if (l.queued) {
+                    // 之后还要直接调用，不能移动消息。
+                    std::unique_lock lock(mtx);
+                    seal(obj, ++seq);
+                    tap(obj);
+                    latch(obj);
+                    deliver(lock, &obj, [&obj](C &c, bool last) { c.push(obj); }, &l);
+                } else {
+                    seal(obj, ++seq);
+                }
+                call_direct(l, obj);
+            } else {
+                call_direct(l, obj);
+                if (!l.queued) return;
+                std::unique_lock lock(mtx);
+                tap(obj);
+                latch(obj);
+                deliver(lock, &obj, [&obj](C &c, bool last) {
+                    if (last) c.push(std::move(obj));
+                    else c.push(obj);
+                }, &l);
+            }
+        }
+
+        // 从订阅者容器中取出消息，需持有锁。
+        MessageStatus take(const s_iter &iter, T &obj) {
+            if (iter->disconnected) return MessageStatus::DISCONNECTED;
+            // 发布者都已退出时仍先取完容器中的消息，如锁存的消息。
+            if (iter->c.empty()) return MessageStatus::EMPTY;
+            obj = std::move(iter->c.pop());
+            if (iter->waiting > 0) space_cv.notify_all();
             return MessageStatus::OK;
         }
 
+        MessageStatus pop(const s_iter &iter, T &obj) {
+            std::unique_lock lock(mtx);
+            cv.wait(lock, [this, &iter]() { return !iter->c.empty() || publisher_ref == 0 || iter->disconnected; });
+            return take(iter, obj);
+        }
+
         template<typename _Rep, typename _Period>
         MessageStatus pop(const s_iter &iter, T &obj, const std::chrono::duration<_Rep, _Period> &dt) {
             std::unique_lock lock(mtx);
-            if (!cv.wait_for(lock, dt, [this, &iter]() { return !iter->empty() || publisher_ref == 0; }))
+            auto ready = [this, &iter]() { return !iter->c.empty() || publisher_ref == 0 || iter->disconnected; };
+            // 不等待时直接返回，超时时间已到的定时等待仍会进入内核，耗时数十微秒。
+            if (!ready() && (dt <= dt.zero() || !cv.wait_for(lock, dt, ready)))
                 return MessageStatus::TIMEOUT;
-            if (publisher_ref == 0) return MessageStatus::EMPTY;
-            obj = std::move(iter->pop());
-            return MessageStatus::OK;
+            return take(iter, obj);
+        }
+
+        // 能否从二进制数据还原，录制与回放使用同一条件。
+        static constexpr bool raw_replayable = std::is_trivially_copyable_v<T> ||
+                                               (isSerializable<T> && std::is_default_constructible_v<T>);
+
+    public:
+        /***** RawMessage接口 *****/
+        const char *raw_type() const override {
+            return typeid(T).name();
+        }
+
+        bool raw_recordable() const override {
+            return raw_replayable;
+        }
+
+        void attach_tap(RawTap *t) override {
+            std::unique_lock lock(mtx);
+            taps.push_back(t);
+            version++;
+        }
+
+        void detach_tap(RawTap *t) override {
+            std::unique_lock lock(mtx);
+            taps.erase(std::remove(taps.begin(), taps.end(), t), taps.end());
+            version++;
+        }
+
+        void raw_attach_publisher() override {
+            attach_publisher();
+        }
+
+        void raw_detach_publisher() override {
+            detach_publisher(Empty());
+        }
+
+        bool raw_push(const void *data, std::size_t size) override {
+            if constexpr(std::is_trivially_copyable_v<T>) {
+                if (size != sizeof(T)) return false;
+                alignas(T) unsigned char buf[sizeof(T)];
+                std::memcpy(buf, data, sizeof(T));
+                // 经过直接调用的路径，使在所有线程中直接调用的订阅者也能收到回放的数据。
+                publish(Empty(), *std::launder(reinterpret_cast<T *>(buf)));
+                return true;
+            } else if constexpr(raw_replayable) {
+                T obj;
+                if (!deserialize(obj, data, size)) return false;
+                publish(Empty(), std::move(obj));
+                return true;
+            } else {
+                return false;
+            }
         }
     };
 
@@ -254,9 +894,12 @@ namespace tOS {
     private:
         SharedObj<M> m;
         typename M::p_iter iter;
+        // 订阅者个数变化的回调
+        std::optional<Demand::w_iter> watch;
 
-        using ValType = typename M::ValType;
     public:
+        using ValType = typename M::ValType;
+
         ~Publisher() {
             reset();
         }
@@ -276,27 +919,67 @@ namespace tOS {
         operator bool() { return m; }
 
         inline void push(const ValType &obj) {
-            m->push(iter, obj);
+            if constexpr(isMultiMessage<M>) m->publish(iter, obj);
+            else m->push(iter, obj);
         }
 
         inline void push(ValType &&obj) {
-            m->push(iter, std::move(obj));
+            if constexpr(isMultiMessage<M>) m->publish(iter, std::move(obj));
+            else m->push(iter, std::move(obj));
         }
 
         template<class ...Ts>
         inline void emplace(Ts &&... args) {
+            if constexpr(isMultiMessage<M>) {
+                if (m->has_direct()) {
+                    m->publish(iter, ValType{std::forward<Ts>(args)...});
+                    return;
+                }
+            }
             m->emplace(iter, std::forward<Ts>(args)...);
         }
 
         inline void reset() {
             if (!m) return;
+            if (watch) m->unwatch_demand(*watch);
+            watch.reset();
             m->detach_publisher(iter);
             m.reset();
         }
 
+        /* 设置订阅者个数变化时的回调f(num)，num为变化后的订阅者个数，设置时立即以当前个数调用一次。
+         * 传入空函数时取消回调。f在订阅者线程中、消息的锁内调用，应当简短且不能访问该消息。
+         */
+        template<class F>
+        inline void set_subscriber_callback(F &&f) {
+            if (watch) m->unwatch_demand(*watch);
+            watch.reset();
+            Demand::Callback cb(std::forward<F>(f));
+            if (cb) watch = m->watch_demand(std::move(cb));
+        }
+
+        // 是否有订阅者，没有时可以跳过耗时的生产。
+        inline bool has_subscribers() { return m->demand.get() > 0; }
+
+        // 阻塞直到有订阅者。
+        inline void wait_for_subscribers() { m->wait_demand(nullptr); }
+
+        // 阻塞直到有订阅者或超时，返回是否有订阅者。
+        template<typename _Rep, typename _Period>
+        inline bool wait_for_subscribers(const std::chrono::duration<_Rep, _Period> &dt) {
+            auto until = std::chrono::steady_clock::now() + dt;
+            return m->wait_demand(&until);
+        }
+
+        // 开启锁存，保留最近发布的depth条消息并补发给之后创建的订阅者，为0时关闭。仅MultiMessage支持。
+        inline void set_latch(std::size_t depth) {
+            static_assert(isMultiMessage<M>, "only MultiMessage supports latch.");
+            m->set_latch(depth);
+        }
+
         inline std::size_t get_publisher_num() { return m->publisher_ref; }
 
-        inline std::size_t get_subscriber_num() { return m->subscriber_ref; }
+        inline std::size_t get_subscriber_num() { return m->demand.get(); }
     };
 
     /* 消息监听器
@@ -309,7 +992,25 @@ namespace tOS {
         SharedObj<M> m;
         typename M::s_iter iter;
 
+    public:
         using ValType = typename M::ValType;
+
+    private:
+        using Tracker = std::conditional_t<isEnvelope<ValType>, EnvelopeTracker, Empty>;
+        // 消息为信封时的序号和时延统计，放在堆上使回调持有的指针不受Subscriber移动的影响。
+        // 只在订阅信封时分配，其他订阅者和默认构造的订阅者为空。
+        std::unique_ptr<Tracker> tracker;
+
+        static std::unique_ptr<Tracker> make_tracker() {
+            if constexpr(isEnvelope<ValType>) return std::make_unique<Tracker>();
+            else return nullptr;
+        }
+
+        inline MessageStatus receive(MessageStatus s, const ValType &obj) {
+            if constexpr(isEnvelope<ValType>) if (s == MessageStatus::OK) tracker->receive(obj);
+            return s;
+        }
+
     public:
         ~Subscriber() {
             reset();
@@ -317,9 +1018,9 @@ namespace tOS {
 
         Subscriber() = default;
 
-        Subscriber(const SharedObj<M> &_m) : m(_m), iter(m->attach_subscriber()) {}
+        Subscriber(const SharedObj<M> &_m) : m(_m), iter(m->attach_subscriber()), tracker(make_tracker()) {}
 
-        Subscriber(SharedObj<M> &&_m) : m(std::move(_m)), iter(m->attach_subscriber()) {}
+        Subscriber(SharedObj<M> &&_m) : m(std::move(_m)), iter(m->attach_subscriber()), tracker(make_tracker()) {}
 
         Subscriber(const Subscriber &p) = delete;
 
@@ -333,11 +1034,133 @@ namespace tOS {
 
         template<typename _Rep, typename _Period>
         inline MessageStatus pop(ValType &obj, const std::chrono::duration<_Rep, _Period> &dt) {
-            return m->pop(iter, obj, dt);
+            return receive(m->pop(iter, obj, dt), obj);
         }
 
         inline MessageStatus pop(ValType &obj) {
-            return m->pop(iter, obj);
+            return receive(m->pop(iter, obj), obj);
+        }
+
+        // 因序号不连续而判断丢失的消息数。仅消息为信封时支持。
+        inline std::size_t get_gap_num() const {
+            static_assert(isEnvelope<ValType>, "only Envelope supports gap detection.");
+            return tracker ? tracker->gap : 0;
+        }
+
+        // 设置订阅者的服务质量，同时恢复已断开的订阅者。仅MultiMessage支持。
+        inline void set_qos(const SubscriberQoS &qos) {
+            static_assert(isMultiMessage<M>, "only MultiMessage supports qos.");
+            m->set_qos(iter, qos);
+        }
+
+        // 因容器满而丢弃的消息数。仅MultiMessage支持。
+        inline std::size_t get_drop_num() {
+            static_assert(isMultiMessage<M>, "only MultiMessage supports qos.");
+            return m->get_drop_num(iter);
+        }
+
+        /* 设置内容过滤条件，发布时只复制filter返回true的消息，传入空函数时取消过滤。仅MultiMessage支持。
+         * filter在发布者线程中、消息的锁内调用，应当简短且不能访问该消息。
+         */
+        template<class F>
+        inline void set_filter(F &&filter) {
+            static_assert(isMultiMessage<M>, "only MultiMessage supports filter.");
+            m->set_filter(iter, std::function<bool(const ValType &)>(std::forward<F>(filter)));
+        }
+
+        // 设置最大接收频率（Hz），超出的消息在发布时直接跳过，为0时不限频。仅MultiMessage支持。
+        inline void set_max_rate(double hz) {
+            static_assert(isMultiMessage<M>, "only MultiMessage supports filter.");
+            m->set_max_rate(iter, hz);
+        }
+
+        // 被过滤或限频跳过的消息数。仅MultiMessage支持。
+        inline std::size_t get_filtered_num() {
+            static_assert(isMultiMessage<M>, "only MultiMessage supports filter.");
+            return m->get_filtered_num(iter);
+        }
+
+        // 合并队列中被相同键的新消息原地替换的消息数。仅CONFLATE容器支持。
+        inline std::size_t get_conflated_num() {
+            static_assert(isConflatingQueue<typename M::C>, "only CONFLATE supports conflation count.");
+            return m->get_conflated_num(iter);
+        }
+
+        /* 设置回调，之后在本线程中调用spin_once处理其他线程发布的消息。仅MultiMessage支持。
+         * 本线程上的发布者发布时直接调用回调，不经过容器和锁，也不复制消息。设置了过滤条件或限频时仍经过容器。
+         * 设置后该订阅者只能在本线程中使用，回调中不能注销本话题的订阅者。
+         */
+        template<class F>
+        inline void set_callback(F &&f) {
+            static_assert(isMultiMessage<M>, "only MultiMessage supports callback.");
+            auto *t = tracker.get();
+            m->set_callback(iter, [t, f = std::forward<F>(f)](const ValType &obj) mutable {
+                if constexpr(isEnvelope<ValType>) {
+                    // 回调中发布的信封沿用收到的源头，返回后恢复发布者线程原来的源头。
+                    OriginScope scope(obj);
+                    t->receive(obj);
+                    f(obj);
+                } else {
+                    f(obj);
+                }
+            }, false);
+        }
+
+        /* 设置在所有发布者线程中直接调用的回调，用于轻量的数据处理，不需要调用spin_once。仅MultiMessage支持。
+         * 回调可能在多个线程中同时调用，需自行保证线程安全；不更新信封的序号和时延统计。
+         * 注销订阅者或更换回调时等待其他线程中正在进行的调用返回，因此回调中不能注销该订阅者。
+         */
+        template<class F>
+        inline void set_inline_callback(F &&f) {
+            static_assert(isMultiMessage<M>, "only MultiMessage supports callback.");
+            m->set_callback(iter, [f = std::forward<F>(f)](const ValType &obj) mutable {
+                if constexpr(isEnvelope<ValType>) {
+                    OriginScope scope(obj);
+                    f(obj);
+                } else {
+                    f(obj);
+                }
+            }, true);
+        }
+
+        /* 设置通知，消息放入该订阅者的容器、订阅者被断开或最后一个发布者注销时调用。仅MultiMessage支持。
+         * notify在发布者线程中、消息的锁内调用，应当简短且不能访问该消息。用于唤醒等待消息的任务，见Scheduler::wake_on。
+         * 设置了回调时，本线程上的发布者直接调用回调，不会调用notify。
+         */
+        template<class F>
+        inline void set_notify(F &&notify) {
+            static_assert(isMultiMessage<M>, "only MultiMessage supports notify.");
+            m->set_notify(iter, std::function<void()>(std::forward<F>(notify)));
+        }
+
+        // 取出一个其他线程发布的消息并调用回调，返回值同pop。仅MultiMessage支持。
+        inline MessageStatus spin_once() {
+            static_assert(isMultiMessage<M>, "only MultiMessage supports callback.");
+            ValType obj;
+            auto s = m->pop(iter, obj);
+            if (s == MessageStatus::OK) m->invoke(iter, obj);
+            return s;
+        }
+
+        template<typename _Rep, typename _Period>
+        inline MessageStatus spin_once(const std::chrono::duration<_Rep, _Period> &dt) {
+            static_assert(isMultiMessage<M>, "only MultiMessage supports callback.");
+            ValType obj;
+            auto s = m->pop(iter, obj, dt);
+            if (s == MessageStatus::OK) m->invoke(iter, obj);
+            return s;
+        }
+
+        // 设置主动队列管理策略。仅SingleMessage支持。
+        inline void set_aqm(const AQMPolicy &policy) {
+            static_assert(isSingleMessage<M>, "only SingleMessage supports aqm.");
+            m->set_aqm(policy);
+        }
+
+        // 主动队列管理的统计信息。仅SingleMessage支持。
+        inline AQMStat get_aqm_stat() {
+            static_assert(isSingleMessage<M>, "only SingleMessage supports aqm.");
+            return m->get_aqm_stat();
         }
 
         inline void reset() {
@@ -348,7 +1171,7 @@ namespace tOS {
 
         inline std::size_t get_publisher_num() { return m->publisher_ref; }
 
-        inline std::size_t get_subscriber_num() { return m->subscriber_ref; }
+        inline std::size_t get_subscriber_num() { return m->demand.get(); }
     };
 }
 
@@ -7,11 +7,14 @@
 
 #include <fmt/format.h>
 #include "Sync.h"
+#include "../utils/SlabResource.h"
 #include "Message.h"
 #include "Request.h"
+#include "Stream.h"
 #include "Logger.h"
 #include "Container.h"
 #include "ObjManager.h"
+#include "Param.h"
 
 namespace tOS {
     // 线程id到node名称的map。
@@ -28,7 +31,19 @@ namespace tOS {
         // 必须在node线程内创建node对象。
         explicit Node(std::string n) : name(std::move(n)) {
             global_node_map[std::this_thread::get_id()] = name;
+            envelope_node = intern(name);
         };
+
+        // 打开消息或请求包，SIZE为DYNAMIC_SIZE时按配置的容量创建。
+        template<OpenMode MODE, class M, std::size_t SIZE>
+        static SharedObj<M> make_queue(ObjType type, const std::string &name, const Capacity &cap) {
+            if constexpr(SIZE == DYNAMIC_SIZE && MODE != OpenMode::FIND) {
+                auto c = get_capacity(name, cap);
+                return SharedObj<M>::template make<MODE>(type, name, c.capacity, c.max_capacity);
+            } else {
+                return SharedObj<M>::template make<MODE>(type, name);
+            }
+        }
     public:
         bool running{true};
 
@@ -36,28 +51,63 @@ namespace tOS {
             global_node_map.erase(std::this_thread::get_id());
         }
 
+        /* 以下消息和请求包的SIZE为DYNAMIC_SIZE时，容量在运行时确定：
+         * capacity: 首次分配的容量，max_capacity: 最大容量，不大于capacity时容量固定。
+         * 启动脚本通过capacity命令为该名称配置过容量时，以配置为准。
+         */
         template<OpenMode MODE, class T, std::size_t SIZE = 1, ContainerEnum Container = CIRCULAR_QUEUE>
-        auto make_publisher(const std::string &message_name) const {
-            return Publisher{SharedObj<MultiMessage<T, SIZE, Container>>
-                             ::template make<MODE>(ObjType::MESSAGE, message_name)};
+        auto make_publisher(const std::string &message_name, std::size_t capacity = TOS_DYNAMIC_SIZE_DEFAULT,
+                            std::size_t max_capacity = 0) const {
+            return Publisher{make_queue<MODE, MultiMessage<T, SIZE, Container>, SIZE>(
+                    ObjType::MESSAGE, message_name, {capacity, max_capacity})};
         }
 
         template<OpenMode MODE, class T, std::size_t SIZE = 1, ContainerEnum Container = CIRCULAR_QUEUE>
-        auto make_subscriber(const std::string &message_name) const {
-            return Subscriber{SharedObj<MultiMessage<T, SIZE, Container>>::template make<MODE>(
-                    ObjType::MESSAGE, message_name)};
+        auto make_subscriber(const std::string &message_name, std::size_t capacity = TOS_DYNAMIC_SIZE_DEFAULT,
+                             std::size_t max_capacity = 0) const {
+            return Subscriber{make_queue<MODE, MultiMessage<T, SIZE, Container>, SIZE>(
+                    ObjType::MESSAGE, message_name, {capacity, max_capacity})};
+        }
+
+        template<OpenMode MODE, class S, class B, std::size_t SIZE = 1, ContainerEnum Container = CIRCULAR_QUEUE>
+        auto make_client(const std::string &request_name, std::size_t capacity = TOS_DYNAMIC_SIZE_DEFAULT,
+                         std::size_t max_capacity = 0) const {
+            return Client{make_queue<MODE, Request<S, B, SIZE, Container>, SIZE>(
+                    ObjType::REQUEST, request_name, {capacity, max_capacity})};
         }
 
         template<OpenMode MODE, class S, class B, std::size_t SIZE = 1, ContainerEnum Container = CIRCULAR_QUEUE>
-        auto make_client(const std::string &request_name) const {
-            return Client{SharedObj<Request<S, B, SIZE, Container>>::template make<MODE>(
-                    ObjType::REQUEST, request_name)};
+        auto make_server(const std::string &request_name, std::size_t capacity = TOS_DYNAMIC_SIZE_DEFAULT,
+                         std::size_t max_capacity = 0) const {
+            return Server{make_queue<MODE, Request<S, B, SIZE, Container>, SIZE>(
+                    ObjType::REQUEST, request_name, {capacity, max_capacity})};
+        }
+
+        // 带结果缓存的客户端，缓存按请求包名称共享，Hash和Equal为请求元素的哈希和比较方式。
+        template<OpenMode MODE, class S, class B, std::size_t SIZE = 1, ContainerEnum Container = CIRCULAR_QUEUE,
+                class Hash = std::hash<S>, class Equal = std::equal_to<S>>
+        auto make_cached_client(const std::string &request_name, std::size_t capacity = TOS_DYNAMIC_SIZE_DEFAULT,
+                                std::size_t max_capacity = 0) const {
+            using R = Request<S, B, SIZE, Container>;
+            return CachedClient<R, Hash, Equal>{
+                    Client{make_queue<MODE, R, SIZE>(ObjType::REQUEST, request_name, {capacity, max_capacity})},
+                    SharedObj<RequestCache<S, B, Hash, Equal>>::template make<OpenMode::FIND_OR_CREATE>(
+                            ObjType::CACHE, request_name)};
         }
 
+        // 流式请求，每次调用返回结果流，容器只支持CIRCULAR_QUEUE和STACK。
         template<OpenMode MODE, class S, class B, std::size_t SIZE = 1, ContainerEnum Container = CIRCULAR_QUEUE>
-        auto make_server(const std::string &request_name) const {
-            return Server{SharedObj<Request<S, B, SIZE, Container>>::template make<MODE>(
-                    ObjType::REQUEST, request_name)};
+        auto make_stream_client(const std::string &request_name, std::size_t capacity = TOS_DYNAMIC_SIZE_DEFAULT,
+                                std::size_t max_capacity = 0) const {
+            return StreamClient{Client{make_queue<MODE, StreamRequest<S, B, SIZE, Container>, SIZE>(
+                    ObjType::REQUEST, request_name, {capacity, max_capacity})}};
+        }
+
+        template<OpenMode MODE, class S, class B, std::size_t SIZE = 1, ContainerEnum Container = CIRCULAR_QUEUE>
+        auto make_stream_server(const std::string &request_name, std::size_t capacity = TOS_DYNAMIC_SIZE_DEFAULT,
+                                std::size_t max_capacity = 0) const {
+            return StreamServer{Server{make_queue<MODE, StreamRequest<S, B, SIZE, Container>, SIZE>(
+                    ObjType::REQUEST, request_name, {capacity, max_capacity})}};
         }
 
         template<OpenMode MODE, class T, class ...Ts>
@@ -65,6 +115,19 @@ namespace tOS {
             return SharedObj<Sync<T>>::template make<MODE>(ObjType::SYNC, sync_name, std::forward<Ts>(args)...);
         }
 
+        // 命名的slab内存资源，可供多个node的std::pmr容器共享，占用情况可以在shell中查看。
+        template<OpenMode MODE, class ...Ts>
+        auto make_resource(const std::string &resource_name, Ts &&...args) const {
+            return SharedObj<SlabResource>::template make<MODE>(ObjType::RESOURCE, resource_name,
+                                                                std::forward<Ts>(args)...);
+        }
+
+        // 参数集，读者无等待地取得快照，写者原子地发布新版本，可以在shell中通过param命令查看和修改。
+        template<OpenMode MODE, class T, class ...Ts>
+        auto make_param(const std::string &param_name, Ts &&...args) const {
+            return SharedObj<Param<T>>::template make<MODE>(ObjType::PARAM, param_name, std::forward<Ts>(args)...);
+        }
+
         template<OpenMode MODE, class T, class ...Ts>
         SharedObj<T> make_object(const std::string &obj_name, Ts &&...args) const {
             return SharedObj<T>::template make<MODE>(
@@ -0,0 +1,18 @@
+//
+// Created by xinyang on 2020/10/9.
+//
+
+#ifndef TOS_OBJINFO_H
+#define TOS_OBJINFO_H
+
+namespace tOS {
+    /* 共享对象的类型擦除接口的基类
+     * 对象管理器只保存该指针，录制、shell等服务通过dynamic_cast取得所需的接口，如RawMessage、CacheInfo、ParamInfo。
+     */
+    class ObjInfo {
+    public:
+        virtual ~ObjInfo() = default;
+    };
+}
+
+#endif /* TOS_OBJINFO_H */
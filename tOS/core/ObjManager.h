@@ -6,15 +6,23 @@
 #define TOS_OBJMANAGER_H
 
 #include "../tOS_config.h"
+#include "ObjInfo.h"
+#include "RawMessage.h"
 #include <fmt/format.h>
 #include <atomic>
 #include <mutex>
+#include <type_traits>
+#include <typeinfo>
 #include <unordered_map>
 
 namespace tOS {
     struct AnyObj {
         void *any;
         std::atomic_size_t *ref;
+        // 对象的实际类型，用于检查同名对象是否以相同类型打开。
+        const std::type_info *info;
+        // 对象的类型擦除接口，经dynamic_cast取得具体接口，不提供接口的对象为nullptr。
+        ObjInfo *iface{nullptr};
     };
 
     struct MtxMap {
@@ -23,7 +31,7 @@ namespace tOS {
     };
 
     enum class ObjType {
-        MESSAGE = 0, REQUEST, NODE, LOGGER, SYNC, USR_OBJ, TYPE_NUM
+        MESSAGE = 0, REQUEST, NODE, LOGGER, SYNC, RESOURCE, CACHE, PARAM, USR_OBJ, TYPE_NUM
     };
 
     const std::unordered_map<ObjType, std::string> obj_type_name = {
@@ -32,6 +40,9 @@ namespace tOS {
             {ObjType::NODE,    "NODE"},
             {ObjType::LOGGER,  "LOGGER"},
             {ObjType::SYNC,    "SYNC"},
+            {ObjType::RESOURCE, "RESOURCE"},
+            {ObjType::CACHE,   "CACHE"},
+            {ObjType::PARAM,   "PARAM"},
             {ObjType::USR_OBJ, "USR_OBJ"}
     };
 
@@ -52,6 +63,17 @@ namespace tOS {
     template<class T, bool CHECK = TOS_CHECK_DEFAULT>
     class SharedObj {
     private:
+        static AnyObj make_any(T *any, std::atomic_size_t *ref) {
+            if constexpr(std::is_base_of_v<ObjInfo, T>) return AnyObj{any, ref, &typeid(T), any};
+            else return AnyObj{any, ref, &typeid(T)};
+        }
+
+        // 同名对象的类型不一致时（如消息容量或容器不同），static_cast是未定义行为，必须拒绝。
+        static void check_type(const std::unordered_map<std::string, AnyObj>::iterator &iter) {
+            if (*iter->second.info != typeid(T))
+                throw shared_obj_type_error(fmt::format("object '{}' is opened with different type.", iter->first));
+        }
+
         static SharedObj find(ObjType type, const std::string &name) {
             if constexpr(CHECK)
                 if (type < static_cast<ObjType>(0) || type >= ObjType::TYPE_NUM)
@@ -60,6 +82,7 @@ namespace tOS {
             auto &map = obj_map[static_cast<int>(type)].map;
             auto iter = map.find(name);
             if (iter == map.end()) return SharedObj();
+            if constexpr(CHECK) check_type(iter);
             return SharedObj(type, iter);
         }
 
@@ -74,7 +97,7 @@ namespace tOS {
             if (iter != map.end()) return SharedObj();
             auto *any = new T{std::forward<Ts>(args)...};
             auto *ref = new std::atomic_size_t(0);
-            auto[new_iter, success] = map.emplace(name, AnyObj{any, ref});
+            auto[new_iter, success] = map.emplace(name, make_any(any, ref));
             if (new_iter == map.end() || !success) {
                 delete any;
                 delete ref;
@@ -91,10 +114,13 @@ namespace tOS {
             std::unique_lock lock(obj_map[static_cast<int>(type)].mtx);
             auto &map = obj_map[static_cast<int>(type)].map;
             auto iter = map.find(name);
-            if (iter != map.end()) return SharedObj(type, iter);
+            if (iter != map.end()) {
+                if constexpr(CHECK) check_type(iter);
+                return SharedObj(type, iter);
+            }
             auto *any = new T{std::forward<Ts>(args)...};
             auto *ref = new std::atomic_size_t(0);
-            auto[new_iter, success] = map.emplace(name, AnyObj{any, ref});
+            auto[new_iter, success] = map.emplace(name, make_any(any, ref));
             if (new_iter == map.end() || !success) {
                 delete any;
                 delete ref;
@@ -181,6 +207,86 @@ namespace tOS {
             return static_cast<T *>(iter->second.any);
         }
     };
+
+    /* 类型擦除的共享对象
+     * 只能访问对象的RawMessage接口，用于录制、回放等不关心消息类型的服务。
+     * 与SharedObj共享同一引用计数。
+     */
+    class RawObj {
+    private:
+        using iterator = std::unordered_map<std::string, AnyObj>::iterator;
+
+        ObjType type{ObjType::TYPE_NUM};
+        iterator iter{obj_map[0].map.end()};
+        RawMessage *raw{nullptr};
+
+        RawObj(ObjType t, const iterator &i, RawMessage *r) : type(t), iter(i), raw(r) {
+            (*iter->second.ref)++;
+        }
+
+    public:
+        // 查找对象，对象不存在或不是消息时返回空对象。
+        static RawObj find(ObjType type, const std::string &name) {
+            if (type < static_cast<ObjType>(0) || type >= ObjType::TYPE_NUM) return RawObj();
+            std::unique_lock lock(obj_map[static_cast<int>(type)].mtx);
+            auto &map = obj_map[static_cast<int>(type)].map;
+            auto i = map.find(name);
+            if (i == map.end()) return RawObj();
+            auto *r = dynamic_cast<RawMessage *>(i->second.iface);
+            if (r == nullptr) return RawObj();
+            return RawObj(type, i, r);
+        }
+
+        ~RawObj() { reset(); }
+
+        RawObj() = default;
+
+        RawObj(const RawObj &) = delete;
+
+        RawObj(RawObj &&o) : type(o.type), iter(o.iter), raw(o.raw) {
+            o.type = ObjType::TYPE_NUM;
+            o.iter = obj_map[0].map.end();
+            o.raw = nullptr;
+        }
+
+        RawObj &operator=(const RawObj &) = delete;
+
+        RawObj &operator=(RawObj &&o) {
+            reset();
+            type = o.type;
+            iter = o.iter;
+            raw = o.raw;
+            o.type = ObjType::TYPE_NUM;
+            o.iter = obj_map[0].map.end();
+            o.raw = nullptr;
+            return *this;
+        }
+
+        operator bool() const {
+            return type != ObjType::TYPE_NUM && iter != obj_map[0].map.end();
+        }
+
+        void reset() {
+            if (!*this) return;
+            std::unique_lock lock(obj_map[static_cast<int>(type)].mtx);
+            if (--(*iter->second.ref) == 0) {
+                // ObjInfo带有虚析构，可以通过基类指针释放。
+                delete iter->second.iface;
+                delete iter->second.ref;
+                obj_map[static_cast<int>(type)].map.erase(iter);
+            }
+            type = ObjType::TYPE_NUM;
+            iter = obj_map[0].map.end();
+            raw = nullptr;
+        }
+
+        const std::string &name() const { return iter->first; }
+
+        RawMessage *operator->() const {
+            if (!*this) throw empty_shared_obj_error("try access empty raw object.");
+            return raw;
+        }
+    };
 }
 
 #endif /* TOS_OBJMANAGER_H */
@@ -0,0 +1,326 @@
+//
+// Created by xinyang on 2020/10/8.
+//
+
+#ifndef TOS_PARAM_H
+#define TOS_PARAM_H
+
+#include "../tOS_config.h"
+#include "ObjInfo.h"
+#include "Serialize.h"
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace tOS {
+    /* 基于纪元的RCU，读者无等待，写者发布新版本后延迟回收旧版本。
+     * 每个读线程占用一个槽位，进入读临界区时记录当前纪元，退出时清零。
+     * 写者替换指针后推进纪元，旧版本以推进前的纪元退役，
+     * 所有槽位都为0或大于退役纪元时，即宽限期结束后才被释放。
+     */
+    class Rcu {
+    private:
+        struct alignas(TOS_CACHE_LINE_SIZE) Slot {
+            std::atomic_uint64_t epoch{0};
+            std::atomic_bool used{false};
+        };
+
+        // 线程占用的槽位，线程退出时归还。
+        struct Reader {
+            Slot *slot{nullptr};
+            std::size_t depth{0};
+
+            ~Reader() {
+                if (slot == nullptr) return;
+                slot->epoch = 0;
+                slot->used = false;
+            }
+        };
+
+        std::atomic_uint64_t epoch{1};
+        Slot slots[TOS_RCU_MAX_READERS];
+
+        static Reader &reader() {
+            thread_local Reader r;
+            return r;
+        }
+
+        // 线程第一次读取时占用一个空闲槽位。
+        Slot *acquire() {
+            for (auto &s: slots) {
+                bool used = false;
+                if (s.used.compare_exchange_strong(used, true)) return &s;
+            }
+            throw std::runtime_error("too many RCU reader threads, increase TOS_RCU_MAX_READERS.");
+        }
+
+    public:
+        // 进入读临界区，可以嵌套。
+        void lock() {
+            auto &r = reader();
+            if (r.depth++ > 0) return;
+            if (r.slot == nullptr) r.slot = acquire();
+            r.slot->epoch = epoch.load();
+        }
+
+        void unlock() {
+            auto &r = reader();
+            if (--r.depth == 0) r.slot->epoch = 0;
+        }
+
+        // 推进纪元，返回推进前的纪元，在替换指针之后调用，作为旧版本的退役纪元。
+        std::uint64_t advance() { return epoch.fetch_add(1); }
+
+        // 以纪元e退役的对象是否已经没有读者。
+        bool passed(std::uint64_t e) const {
+            for (auto &s: slots) {
+                auto r = s.epoch.load();
+                if (r != 0 && r <= e) return false;
+            }
+            return true;
+        }
+    };
+
+    inline Rcu rcu;
+
+    // 参数值与字符串的转换，用于shell查看和修改，支持算术类型、bool和std::string。
+    template<class U>
+    std::string param_to_string(const U &v) {
+        if constexpr(std::is_same_v<U, bool>) {
+            return v ? "true" : "false";
+        } else if constexpr(std::is_same_v<U, std::string>) {
+            return v;
+        } else if constexpr(std::is_arithmetic_v<U>) {
+            std::ostringstream oss;
+            oss << +v;
+            return oss.str();
+        } else {
+            return "-";
+        }
+    }
+
+    template<class U>
+    bool param_from_string(U &v, const std::string &s) {
+        if constexpr(std::is_same_v<U, bool>) {
+            if (s == "true" || s == "1") v = true;
+            else if (s == "false" || s == "0") v = false;
+            else return false;
+            return true;
+        } else if constexpr(std::is_same_v<U, std::string>) {
+            v = s;
+            return true;
+        } else if constexpr(std::is_arithmetic_v<U>) {
+            // char类型按数值解析。
+            std::conditional_t<std::is_integral_v<U>, std::conditional_t<std::is_signed_v<U>, long long,
+                    unsigned long long>, U> t;
+            // 无符号类型的流输入会接受负数并回绕。
+            if (std::is_unsigned_v<U> && s.find('-') != std::string::npos) return false;
+            std::istringstream iss(s);
+            if (!(iss >> t) || !iss.eof()) return false;
+            if constexpr(std::is_integral_v<U> && std::is_signed_v<U>) {
+                if (t < std::numeric_limits<U>::min() || t > std::numeric_limits<U>::max()) return false;
+            } else if constexpr(std::is_integral_v<U>) {
+                if (t > std::numeric_limits<U>::max()) return false;
+            }
+            v = static_cast<U>(t);
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    // 类型擦除的参数集接口，用于shell查看和修改参数。
+    class ParamInfo : public ObjInfo {
+    public:
+        // 当前版本号，每次发布加一。
+        virtual std::uint64_t get_version() = 0;
+
+        // 各字段的名称和值，参数类型需使用TOS_REFLECT声明成员。
+        virtual std::vector<std::pair<std::string, std::string>> get_fields() = 0;
+
+        // 修改一个字段并发布新版本，字段不存在或值无法解析时返回false。
+        virtual bool set_field(const std::string &field, const std::string &value) = 0;
+    };
+
+    /* 参数集的只读快照，析构前保持有效且不会被修改。
+     * 持有快照期间处于RCU读临界区，不应长时间持有，也不能超过参数集本身的生命周期。
+     */
+    template<class T>
+    class ParamView {
+    private:
+        const T *p{nullptr};
+        std::uint64_t version{0};
+
+    public:
+        ParamView(const T *_p, std::uint64_t v) : p(_p), version(v) {}
+
+        ~ParamView() {
+            if (p != nullptr) rcu.unlock();
+        }
+
+        ParamView(const ParamView &) = delete;
+
+        ParamView(ParamView &&o) : p(o.p), version(o.version) { o.p = nullptr; }
+
+        ParamView &operator=(const ParamView &) = delete;
+
+        ParamView &operator=(ParamView &&) = delete;
+
+        inline const T &operator*() const { return *p; }
+
+        inline const T *operator->() const { return p; }
+
+        inline std::uint64_t get_version() const { return version; }
+    };
+
+    /* RCU保护的参数集
+     * 读者在控制循环中无等待地取得快照，不加锁也不复制；写者复制出新版本修改后原子地发布，写者之间串行。
+     * 旧版本在读者都离开后的下一次写入或reclaim()时释放。
+     * T: 参数集类型，使用TOS_REFLECT声明成员后可以在shell中通过param命令查看和修改
+     */
+    template<class T>
+    class Param : public ParamInfo {
+    private:
+        struct Version {
+            T value;
+            std::uint64_t id;
+        };
+
+        std::atomic<const Version *> current;
+        // 已退役的旧版本及其退役纪元
+        std::vector<std::pair<const Version *, std::uint64_t>> retired;
+        std::mutex mtx;
+
+        // 发布新版本，需持有锁。
+        void publish(const Version *v) {
+            auto *old = current.exchange(v);
+            retired.emplace_back(old, rcu.advance());
+            collect();
+        }
+
+        // 释放已过宽限期的旧版本，需持有锁。
+        void collect() {
+            std::size_t n = 0;
+            for (auto &r: retired) {
+                if (rcu.passed(r.second)) delete r.first;
+                else retired[n++] = r;
+            }
+            retired.resize(n);
+        }
+
+    public:
+        template<class ...Ts>
+        explicit Param(Ts &&...args) : current(new Version{T{std::forward<Ts>(args)...}, 1}) {}
+
+        ~Param() override {
+            delete current.load();
+            for (auto &r: retired) delete r.first;
+        }
+
+        Param(const Param &) = delete;
+
+        Param &operator=(const Param &) = delete;
+
+        // 取得当前版本的快照，无等待。
+        ParamView<T> read() const {
+            rcu.lock();
+            auto *v = current.load();
+            return ParamView<T>(&v->value, v->id);
+        }
+
+        // 发布新版本。
+        void set(T value) {
+            std::unique_lock lock(mtx);
+            publish(new Version{std::move(value), current.load()->id + 1});
+        }
+
+        // 在当前版本的副本上调用f(T &)修改后发布。
+        template<class F>
+        void update(F &&f) {
+            std::unique_lock lock(mtx);
+            auto *cur = current.load();
+            auto *v = new Version{cur->value, cur->id + 1};
+            f(v->value);
+            publish(v);
+        }
+
+        // 释放已过宽限期的旧版本，没有写入时可以定期调用。
+        void reclaim() {
+            std::unique_lock lock(mtx);
+            collect();
+        }
+
+        // 尚未释放的旧版本个数
+        std::size_t get_retired_num() {
+            std::unique_lock lock(mtx);
+            return retired.size();
+        }
+
+        /***** ParamInfo接口 *****/
+        std::uint64_t get_version() override {
+            return current.load()->id;
+        }
+
+        std::vector<std::pair<std::string, std::string>> get_fields() override {
+            std::vector<std::pair<std::string, std::string>> fields;
+            if constexpr(isReflected<T>) {
+                auto names = field_names();
+                auto view = read();
+                std::size_t i = 0;
+                std::apply([&](auto &...fs) {
+                    ((fields.emplace_back(names[i++], param_to_string(fs))), ...);
+                }, view->tos_fields());
+            }
+            return fields;
+        }
+
+        bool set_field(const std::string &field, const std::string &value) override {
+            if constexpr(isReflected<T>) {
+                auto names = field_names();
+                std::unique_lock lock(mtx);
+                auto *cur = current.load();
+                auto *v = new Version{cur->value, cur->id + 1};
+                bool ok = false;
+                std::size_t i = 0;
+                std::apply([&](auto &...fs) {
+                    ((void) (names[i++] == field && (ok = param_from_string(fs, value))), ...);
+                }, v->value.tos_fields());
+                if (!ok) {
+                    delete v;
+                    return false;
+                }
+                publish(v);
+                return true;
+            } else {
+                return false;
+            }
+        }
+
+    private:
+        // 由TOS_REFLECT的参数列表得到各字段的名称。
+        static std::vector<std::string> field_names() {
+            std::vector<std::string> names;
+            std::string name;
+            for (const char *p = T::tos_field_names;; p++) {
+                if (*p == ',' || *p == '\0') {
+                    names.push_back(name);
+                    name.clear();
+                    if (*p == '\0') break;
+                } else if (*p != ' ' && *p != '\t' && *p != '\n') {
+                    name.push_back(*p);
+                }
+            }
+            return names;
+        }
+    };
+}
+
+#endif /* TOS_PARAM_H */
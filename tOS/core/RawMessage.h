@@ -0,0 +1,45 @@
+//
+// Created by xinyang on 2020/9/12.
+//
+
+#ifndef TOS_RAWMESSAGE_H
+#define TOS_RAWMESSAGE_H
+
+#include "ObjInfo.h"
+#include <cstddef>
+
+namespace tOS {
+    // 原始数据监听器，接收消息的二进制表示。
+    // on_raw在发布者线程中、持有消息锁时被调用，不应阻塞。
+    class RawTap {
+    public:
+        virtual ~RawTap() = default;
+
+        virtual void on_raw(const void *data, std::size_t size) = 0;
+    };
+
+    /* 类型擦除的消息接口
+     * 用于录制、回放等只关心消息二进制表示、不关心消息类型的服务。
+     */
+    class RawMessage : public ObjInfo {
+    public:
+        // 消息元素的类型名称，用于回放时校验类型。
+        virtual const char *raw_type() const = 0;
+
+        // 消息元素能否录制并回放（可平凡复制，或可序列化且可默认构造）。
+        virtual bool raw_recordable() const = 0;
+
+        virtual void attach_tap(RawTap *tap) = 0;
+
+        virtual void detach_tap(RawTap *tap) = 0;
+
+        virtual void raw_attach_publisher() = 0;
+
+        virtual void raw_detach_publisher() = 0;
+
+        // 以二进制数据发布一条消息，数据格式不匹配时返回false。
+        virtual bool raw_push(const void *data, std::size_t size) = 0;
+    };
+}
+
+#endif /* TOS_RAWMESSAGE_H */
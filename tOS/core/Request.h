@@ -5,9 +5,15 @@
 #ifndef TOS_REQUEST_H
 #define TOS_REQUEST_H
 
+#include "AQM.h"
+#include "Cache.h"
 #include "Container.h"
 #include "Message.h"
+#include <atomic>
 #include <future>
+#include <list>
+#include <memory>
+#include <stdexcept>
 
 namespace tOS {
     // 服务端
@@ -18,40 +24,225 @@ namespace tOS {
     template<class R>
     class Client;
 
-    /* 请求包，默认请求容器满时会覆盖未处理的请求。
+    // 请求因排队过久被AQM丢弃时，客户端future抛出该异常。
+    struct request_dropped_error : public std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    // 请求在截止时间前未被服务端取走时，客户端future抛出该异常。
+    struct request_expired_error : public std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    // 一次请求调用的截止时间和取消标志，由客户端的RequestFuture和请求包中的条目共享。
+    struct CallToken {
+        std::chrono::steady_clock::time_point deadline{std::chrono::steady_clock::time_point::max()};
+        std::atomic_bool cancelled{false};
+    };
+
+    // 用于判断请求元素是否带有成员deadline。
+    template<class S, class = void>
+    constexpr bool hasDeadline = false;
+
+    template<class S>
+    constexpr bool hasDeadline<S, std::void_t<decltype(std::declval<const S &>().deadline)>> = true;
+
+    // 服务端跳过的请求的统计信息
+    struct CallStat {
+        // 超过截止时间的请求数
+        std::size_t expired{0};
+        // 被客户端取消的请求数
+        std::size_t cancelled{0};
+    };
+
+    /* 请求的返回值，接口与std::future一致。
+     * 在取走结果之前调用cancel时取消该请求，尚未处理的请求会被服务端跳过。
+     * 默认析构时不取消，与std::future一致，丢弃返回值的请求仍会被处理；可以通过set_cancel_on_destroy开启。
+     * B: 请求返回类型
+     */
+    template<class B>
+    class RequestFuture {
+    private:
+        std::future<B> f;
+        std::shared_ptr<CallToken> token;
+        // 析构或被赋值时是否取消请求
+        bool scoped{false};
+    public:
+        ~RequestFuture() {
+            if (scoped) cancel();
+        }
+
+        RequestFuture() = default;
+
+        RequestFuture(std::future<B> &&_f, std::shared_ptr<CallToken> t) : f(std::move(_f)), token(std::move(t)) {}
+
+        RequestFuture(const RequestFuture &p) = delete;
+
+        RequestFuture(RequestFuture &&p) = default;
+
+        RequestFuture &operator=(const RequestFuture &p) = delete;
+
+        RequestFuture &operator=(RequestFuture &&p) {
+            if (scoped) cancel();
+            f = std::move(p.f);
+            token = std::move(p.token);
+            scoped = p.scoped;
+            return *this;
+        }
+
+        inline B get() { return f.get(); }
+
+        inline bool valid() const { return f.valid(); }
+
+        inline void wait() const { f.wait(); }
+
+        template<typename _Rep, typename _Period>
+        inline std::future_status wait_for(const std::chrono::duration<_Rep, _Period> &dt) const {
+            return f.wait_for(dt);
+        }
+
+        template<typename _Clock, typename _Duration>
+        inline std::future_status wait_until(const std::chrono::time_point<_Clock, _Duration> &tp) const {
+            return f.wait_until(tp);
+        }
+
+        // 取消请求，结果已取走时无效。
+        inline void cancel() {
+            if (f.valid() && token) token->cancelled = true;
+        }
+
+        // 设置析构时是否取消请求，用于调用方放弃等待时服务端不再处理的场景。
+        inline void set_cancel_on_destroy(bool on) {
+            scoped = on;
+        }
+
+        // 放弃结果但不取消请求，之后析构和cancel都不再取消。
+        inline void detach() {
+            token.reset();
+        }
+
+        // 转为可被多处等待的std::shared_future，同时放弃取消请求的能力。
+        inline std::shared_future<B> share() {
+            token.reset();
+            return f.share();
+        }
+    };
+
+    /* 多服务端时请求的分发方式
+     * SHARED: 所有服务端从同一个容器获取请求，每个请求只唤醒一个空闲的服务端
+     * ROUND_ROBIN: 请求依次放入各服务端自己的容器
+     * LEAST_LOADED: 请求放入排队数加正在处理数最少的服务端的容器
+     * WORK_STEALING: 同ROUND_ROBIN，但空闲的服务端会从排队最多的服务端取走请求
+     */
+    enum class DispatchPolicy {
+        SHARED = 0, ROUND_ROBIN, LEAST_LOADED, WORK_STEALING
+    };
+
+    /* 请求包，默认请求容器满时会覆盖未处理的请求，可以开启AQM拒绝排队过久的请求。
      * 即同一请求仅可被不同服务端中的某一位处理
+     * 服务端取请求时自动跳过已超过截止时间或已被客户端取消的请求
+     * 每个服务端在自己的条件变量上等待，请求只唤醒被分发到的服务端
      * S: 请求元素类型
      * B: 请求返回类型
-     * size: 请求包容量
-     * Container: 请求包容器，也即请求包传递方式。包括循环队列和栈
+     * size: 请求包容量，为DYNAMIC_SIZE时在创建时指定。各服务端的容器容量相同
+     * Container: 请求包容器，也即请求包传递方式。包括循环队列、栈、优先队列和截止时间队列。
+     *            截止时间队列按调用的截止时间排序，调用未设置截止时间时使用请求元素的成员deadline
      */
     template<class S, class B, std::size_t SIZE = 1, ContainerEnum Container = CIRCULAR_QUEUE>
     class Request {
-        static_assert(SIZE > 0, "size must larger than 1.");
-        static_assert(Container == CIRCULAR_QUEUE || CIRCULAR_QUEUE == STACK,
-                      "Container must be either CIRCULAR_QUEUE or STACK.");
+        static_assert(isContainerEnum<Container>, "Container must be one of ContainerEnum.");
+        // 合并会丢弃被替换请求的返回值，请求包不支持合并队列。
+        static_assert(Container != CONFLATE, "Request does not support CONFLATE.");
 
         friend class Server<Request>;
 
         friend class Client<Request>;
 
+        friend class SharedObj<Request>;
+
     private:
         using SendType = S;
         using BackType = B;
 
         using T = std::pair<S, std::promise<B>>;
-        using C = std::conditional_t<Container == CIRCULAR_QUEUE,
-                CircularQueue < T, SIZE, false>, Stack<T, SIZE, false>>;
 
-        // 所有服务端从同一个容器获取请求。
+        // 请求包中的条目，除请求外还带有入队时间戳和调用的取消标志。
+        struct Call {
+            T value;
+            std::chrono::steady_clock::time_point stamp;
+            std::shared_ptr<CallToken> token;
+
+            template<class U>
+            Call(U &&obj, std::promise<B> &&p, std::chrono::steady_clock::time_point s, std::shared_ptr<CallToken> t) :
+                    value(std::forward<U>(obj), std::move(p)), stamp(s), token(std::move(t)) {}
+        };
+
+        template<class D>
+        struct Deadline {
+            D deadline;
+        };
+
+        /* EDF的排序依据：调用设置了截止时间（push_for、push_until）时使用该截止时间，否则使用请求元素S的成员deadline。
+         * S::deadline不是steady_clock的时间点时无法混合比较，先按调用的截止时间、再按S::deadline排序。
+         */
+        struct CallDeadline {
+            auto operator()(const Call &call) const {
+                using time_point = std::chrono::steady_clock::time_point;
+                auto d = call.token->deadline;
+                if constexpr(!hasDeadline<S>) {
+                    return Deadline<time_point>{d};
+                } else if constexpr(std::is_convertible_v<decltype(call.value.first.deadline), time_point>) {
+                    if (d == time_point::max()) d = call.value.first.deadline;
+                    return Deadline<time_point>{d};
+                } else {
+                    return Deadline<std::pair<time_point, std::decay_t<decltype(call.value.first.deadline)>>>{
+                            {d, call.value.first.deadline}};
+                }
+            }
+        };
+
+        // 优先级只取决于请求元素S；截止时间（EDF）优先取调用的截止时间。
+        using C = ContainerType<Call, SIZE, Container,
+                std::conditional_t<Container == EDF, CallDeadline, StampedKey<KeyFirst>>>;
+
+        // 服务端各自的容器和等待状态
+        struct ServerEntry {
+            C c;
+            std::condition_variable cv;
+            // 是否正在等待请求
+            bool idle{false};
+            // 是否正在处理取走的请求
+            bool busy{false};
+
+            template<class ...Ts>
+            explicit ServerEntry(Ts &&...args) : c(std::forward<Ts>(args)...) {}
+        };
+
+        using s_iter = typename std::list<ServerEntry>::iterator;
+
+        // 共享容器。SHARED方式下的请求、没有服务端时的请求以及注销的服务端遗留的请求都放在这里。
         C c;
+        std::list<ServerEntry> servers;
+        // ROUND_ROBIN和WORK_STEALING下一个分发的服务端
+        s_iter next{servers.end()};
+        DispatchPolicy policy{DispatchPolicy::SHARED};
+        // 服务端容器的容量
+        Capacity cap{SIZE, SIZE};
+        // 主动队列管理
+        CoDel aqm;
+        CallStat call_stat;
         // 该请求上的服务段的个数
         std::size_t server_ref{0};
         // 该请求上的客户段的个数
         std::size_t client_ref{0};
         // 用于线程同步
         std::mutex mtx;
-        std::condition_variable cv;
+
+        // 私有构造使得该类不能被直接创建。
+        Request() = default;
+
+        Request(std::size_t capacity, std::size_t max_capacity) :
+                c(capacity, max_capacity), cap{capacity, max_capacity} {}
 
         void attach_client() {
             std::unique_lock lock(mtx);
@@ -63,60 +254,192 @@ namespace tOS {
             client_ref--;
         }
 
-        void attach_server() {
+        s_iter attach_server() {
             std::unique_lock lock(mtx);
             server_ref++;
+            if constexpr(SIZE == DYNAMIC_SIZE) servers.emplace_back(cap.capacity, cap.max_capacity);
+            else servers.emplace_back();
+            return std::prev(servers.end());
         }
 
-        void detach_server() {
+        // 注销服务端，未处理的请求转入共享容器，交给其他服务端。
+        void detach_server(const s_iter &iter) {
             std::unique_lock lock(mtx);
             server_ref--;
+            while (!iter->c.empty()) place(c, iter->c.pop());
+            if (next == iter) next = std::next(iter);
+            servers.erase(iter);
+            if (!c.empty()) wake_idle();
         }
 
-        std::future<B> push(const S &obj) {
+        void set_aqm(const AQMPolicy &p) {
             std::unique_lock lock(mtx);
-            std::promise<B> promise;
-            auto future = promise.get_future();
-            if (c.full()) c.pop();
-            c.emplace(obj, std::move(promise));
-            cv.notify_all();
-            return future;
+            aqm.set_policy(p);
         }
 
-        std::future<B> push(S &&obj) {
+        AQMStat get_aqm_stat() {
             std::unique_lock lock(mtx);
-            std::promise<B> promise;
-            auto future = promise.get_future();
-            if (c.full()) c.pop();
-            c.emplace(std::move(obj), std::move(promise));
-            cv.notify_all();
-            return std::move(future);
+            return aqm.get_stat();
         }
 
-        template<class ...Ts>
-        std::future<B> emplace(Ts &&...args) {
+        CallStat get_call_stat() {
             std::unique_lock lock(mtx);
+            return call_stat;
+        }
+
+        void set_dispatch(DispatchPolicy p) {
+            std::unique_lock lock(mtx);
+            policy = p;
+            // 空闲服务端的等待条件可能改变。
+            for (auto &e: servers) e.cv.notify_one();
+        }
+
+        // 因容器满被丢弃的请求，与AQM丢弃的请求一样，客户端future抛出request_dropped_error。
+        static void reject(Call &&call) {
+            call.value.second.set_exception(std::make_exception_ptr(
+                    request_dropped_error("request dropped for queue full.")));
+        }
+
+        // 由args在容器中原地构造条目，满时覆盖；优先队列中该条目不比已有条目更优先时丢弃该条目。需持有锁。
+        template<class ...Ts>
+        void place(C &dst, Ts &&...args) {
+            if (dst.full()) {
+                aqm.evicted();
+                if constexpr(isPriorityQueue<C>) {
+                    // 需要先构造出条目，与优先级最低者比较。
+                    Call call(std::forward<Ts>(args)...);
+                    if (dst.evict(call, [](Call &&e) { reject(std::move(e)); })) dst.push(std::move(call));
+                    else reject(std::move(call));
+                    return;
+                } else {
+                    reject(dst.pop());
+                }
+            }
+            dst.emplace(std::forward<Ts>(args)...);
+        }
+
+        // 唤醒一个空闲的服务端，返回是否存在空闲的服务端。需持有锁。
+        bool wake_idle() {
+            for (auto &e: servers) {
+                if (e.idle) {
+                    e.idle = false;
+                    e.cv.notify_one();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // 按分发方式选出接收请求的服务端。需持有锁且存在服务端。
+        s_iter select() {
+            if (policy == DispatchPolicy::LEAST_LOADED) {
+                auto best = servers.begin();
+                for (auto it = servers.begin(); it != servers.end(); ++it) {
+                    if (it->c.size() + it->busy < best->c.size() + best->busy) best = it;
+                }
+                return best;
+            }
+            if (next == servers.end()) next = servers.begin();
+            return next++;
+        }
+
+        // 放入请求，请求在容器中原地复制或移动构造，返回对应的future。
+        template<class U>
+        RequestFuture<B> put(U &&obj, std::chrono::steady_clock::time_point deadline) {
+            auto token = std::make_shared<CallToken>();
+            token->deadline = deadline;
             std::promise<B> promise;
             auto future = promise.get_future();
-            if (c.full()) c.pop();
-            c.emplace(S{std::forward<Ts>(args)...}, std::move(promise));
-            cv.notify_all();
-            return std::move(future);
+            std::unique_lock lock(mtx);
+            if (policy == DispatchPolicy::SHARED || servers.empty()) {
+                place(c, std::forward<U>(obj), std::move(promise), aqm.stamp(), token);
+                wake_idle();
+            } else {
+                auto s = select();
+                place(s->c, std::forward<U>(obj), std::move(promise), aqm.stamp(), token);
+                // 目标服务端正忙时，由空闲的服务端窃取。
+                if (s->idle || policy != DispatchPolicy::WORK_STEALING || !wake_idle()) {
+                    s->idle = false;
+                    s->cv.notify_one();
+                }
+            }
+            return RequestFuture<B>(std::move(future), std::move(token));
+        }
+
+        // 服务端的请求来源：自己的容器、共享容器，WORK_STEALING时还包括排队最多的其他服务端。需持有锁。
+        C *source(const s_iter &iter) {
+            if (!iter->c.empty()) return &iter->c;
+            if (!c.empty()) return &c;
+            if (policy != DispatchPolicy::WORK_STEALING) return nullptr;
+            C *victim = nullptr;
+            for (auto &e: servers) {
+                if (!e.c.empty() && (victim == nullptr || e.c.size() > victim->size())) victim = &e.c;
+            }
+            return victim;
         }
 
+        // 取出一个需要处理的请求，跳过已取消、已超时和被AQM拒绝的请求。需持有锁，没有可处理的请求时返回false。
+        bool take(const s_iter &iter, T &obj) {
+            while (auto *src = source(iter)) {
+                auto e = src->pop();
+                if (e.token->cancelled) {
+                    call_stat.cancelled++;
+                    continue;
+                }
+                if (e.token->deadline != std::chrono::steady_clock::time_point::max() &&
+                    e.token->deadline <= std::chrono::steady_clock::now()) {
+                    call_stat.expired++;
+                    e.value.second.set_exception(std::make_exception_ptr(
+                            request_expired_error("request expired before served.")));
+                    continue;
+                }
+                if (aqm.drop(e.stamp, src->empty())) {
+                    e.value.second.set_exception(std::make_exception_ptr(
+                            request_dropped_error("request dropped for queueing too long.")));
+                    continue;
+                }
+                obj = std::move(e.value);
+                iter->busy = true;
+                return true;
+            }
+            return false;
+        }
+
+        RequestFuture<B> push(const S &obj, std::chrono::steady_clock::time_point deadline) {
+            return put(obj, deadline);
+        }
+
+        RequestFuture<B> push(S &&obj, std::chrono::steady_clock::time_point deadline) {
+            return put(std::move(obj), deadline);
+        }
+
+        template<class ...Ts>
+        RequestFuture<B> emplace(Ts &&...args) {
+            return put(S{std::forward<Ts>(args)...}, std::chrono::steady_clock::time_point::max());
+        }
 
-        bool pop(T &obj) {
+        bool pop(const s_iter &iter, T &obj) {
             std::unique_lock lock(mtx);
-            cv.wait(lock, [this]() { return !c.empty(); });
-            obj = std::move(c.pop());
+            iter->busy = false;
+            while (!take(iter, obj)) {
+                iter->idle = true;
+                iter->cv.wait(lock);
+                iter->idle = false;
+            }
             return true;
         }
 
         template<typename _Rep, typename _Period>
-        bool pop(T &obj, const std::chrono::duration<_Rep, _Period> &dt) {
+        bool pop(const s_iter &iter, T &obj, const std::chrono::duration<_Rep, _Period> &dt) {
+            auto until = std::chrono::steady_clock::now() + dt;
             std::unique_lock lock(mtx);
-            if (!cv.wait_for(lock, dt, [this]() { return !c.empty(); })) return false;
-            obj = std::move(c.pop());
+            iter->busy = false;
+            while (!take(iter, obj)) {
+                if (std::chrono::steady_clock::now() >= until) return false;
+                iter->idle = true;
+                iter->cv.wait_until(lock, until);
+                iter->idle = false;
+            }
             return true;
         }
     };
@@ -147,9 +470,9 @@ namespace tOS {
 
         Client() = default;
 
-        Client(const SharedObj <R> &_r) : r(_r) { r->attach_server(); }
+        Client(const SharedObj <R> &_r) : r(_r) { r->attach_client(); }
 
-        Client(SharedObj <R> &&_r) : r(std::move(_r)) { r->attach_server(); }
+        Client(SharedObj <R> &&_r) : r(std::move(_r)) { r->attach_client(); }
 
         Client(const Client &p) = delete;
 
@@ -161,22 +484,43 @@ namespace tOS {
 
         operator bool() { return r; }
 
-        inline std::future<BackType> push(const SendType &obj) {
-            return r->push(obj);
+        inline RequestFuture<BackType> push(const SendType &obj) {
+            return r->push(obj, std::chrono::steady_clock::time_point::max());
         }
 
-        inline std::future<BackType> push(SendType &&obj) {
-            return r->push(std::move(obj));
+        inline RequestFuture<BackType> push(SendType &&obj) {
+            return r->push(std::move(obj), std::chrono::steady_clock::time_point::max());
         }
 
         template<class ...Ts>
-        inline std::future<BackType> emplace(Ts &&...args) {
+        inline RequestFuture<BackType> emplace(Ts &&...args) {
             return r->emplace(std::forward<Ts>(args)...);
         }
 
+        // 带截止时间的请求，dt时间内未被服务端取走时被跳过，future抛出request_expired_error。
+        template<typename _Rep, typename _Period>
+        inline RequestFuture<BackType> push_for(const SendType &obj, const std::chrono::duration<_Rep, _Period> &dt) {
+            return r->push(obj, std::chrono::steady_clock::now() + dt);
+        }
+
+        template<typename _Rep, typename _Period>
+        inline RequestFuture<BackType> push_for(SendType &&obj, const std::chrono::duration<_Rep, _Period> &dt) {
+            return r->push(std::move(obj), std::chrono::steady_clock::now() + dt);
+        }
+
+        inline RequestFuture<BackType> push_until(const SendType &obj,
+                                                  const std::chrono::steady_clock::time_point &deadline) {
+            return r->push(obj, deadline);
+        }
+
+        inline RequestFuture<BackType> push_until(SendType &&obj,
+                                                  const std::chrono::steady_clock::time_point &deadline) {
+            return r->push(std::move(obj), deadline);
+        }
+
         inline void reset() {
             if (!r) return;
-            r->detach_server();
+            r->detach_client();
             r.reset();
         }
 
@@ -193,6 +537,7 @@ namespace tOS {
         static_assert(isRequest<R>, "R must be Request.");
     private:
         SharedObj <R> r;
+        typename R::s_iter iter;
     public:
         using SendType = typename R::SendType;
         using BackType = typename R::BackType;
@@ -204,9 +549,9 @@ namespace tOS {
 
         Server() = default;
 
-        Server(const SharedObj <R> &_r) : r(_r) { r->attach_client(); }
+        Server(const SharedObj <R> &_r) : r(_r), iter(r->attach_server()) {}
 
-        Server(SharedObj <R> &&_r) : r(std::move(_r)) { r->attach_client(); }
+        Server(SharedObj <R> &&_r) : r(std::move(_r)), iter(r->attach_server()) {}
 
         Server(const Server &p) = delete;
 
@@ -219,17 +564,37 @@ namespace tOS {
         operator bool() { return r; }
 
         inline bool pop(T &obj) {
-            return r->pop(obj);
+            return r->pop(iter, obj);
         }
 
         template<typename _Rep, typename _Period>
         inline bool pop(T &obj, const std::chrono::duration<_Rep, _Period> &dt) {
-            return r->pop(obj, dt);
+            return r->pop(iter, obj, dt);
+        }
+
+        // 设置多服务端时请求的分发方式，对该请求包的所有服务端生效。
+        inline void set_dispatch(DispatchPolicy policy) {
+            r->set_dispatch(policy);
+        }
+
+        // 设置主动队列管理策略。
+        inline void set_aqm(const AQMPolicy &policy) {
+            r->set_aqm(policy);
+        }
+
+        // 主动队列管理的统计信息。
+        inline AQMStat get_aqm_stat() {
+            return r->get_aqm_stat();
+        }
+
+        // 因超时或取消而跳过的请求的统计信息。
+        inline CallStat get_call_stat() {
+            return r->get_call_stat();
         }
 
         inline void reset() {
             if (!r) return;
-            r->detach_client();
+            r->detach_server(iter);
             r.reset();
         }
 
@@ -237,6 +602,59 @@ namespace tOS {
 
         inline std::size_t get_client_num() { return r->client_ref; }
     };
+
+    /* 带结果缓存的客户端
+     * 同一请求包上的所有带缓存客户端共享一个缓存：相同的请求在处理中时只发出一次，处理完成后在有效期内直接返回结果。
+     * 只适用于结果仅取决于请求内容的服务。
+     * R: 请求包类型
+     * Hash, Equal: 请求元素的哈希和比较方式
+     */
+    template<class R, class Hash = std::hash<typename Client<R>::SendType>,
+            class Equal = std::equal_to<typename Client<R>::SendType>>
+    class CachedClient {
+    public:
+        using SendType = typename Client<R>::SendType;
+        using BackType = typename Client<R>::BackType;
+        using Cache = RequestCache<SendType, BackType, Hash, Equal>;
+
+    private:
+        Client<R> c;
+        SharedObj<Cache> cache;
+
+    public:
+        CachedClient() = default;
+
+        CachedClient(Client<R> &&_c, SharedObj<Cache> &&_cache) : c(std::move(_c)), cache(std::move(_cache)) {}
+
+        operator bool() { return c && cache; }
+
+        inline std::shared_future<BackType> push(const SendType &obj) {
+            return cache->get(obj, [this](const SendType &o) { return c.push(o).share(); });
+        }
+
+        // 设置缓存策略，对该请求包的所有带缓存客户端生效。
+        inline void set_cache(const CachePolicy &policy) {
+            cache->set_policy(policy);
+        }
+
+        inline CacheStat get_cache_stat() {
+            return cache->get_stat();
+        }
+
+        // 使某个请求的缓存结果失效，如服务端的数据发生了变化。
+        inline void invalidate(const SendType &obj) {
+            cache->invalidate(obj);
+        }
+
+        inline void clear() {
+            cache->clear();
+        }
+
+        inline void reset() {
+            c.reset();
+            cache.reset();
+        }
+    };
 }
 
 #endif /* TOS_REQUEST_H */
@@ -0,0 +1,229 @@
+//
+// Created by xinyang on 2020/9/24.
+//
+
+#ifndef TOS_SCHEDULER_H
+#define TOS_SCHEDULER_H
+
+#include "../utils/BitMap.h"
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace tOS {
+    // 任务执行一步后返回的状态，决定任务接下来如何被调度。
+    class TaskStatus {
+        friend class Scheduler;
+
+    private:
+        enum Kind {
+            YIELD = 0, SLEEP, WAIT, EXIT
+        };
+
+        Kind kind;
+        std::chrono::steady_clock::time_point until;
+
+        TaskStatus(Kind k, std::chrono::steady_clock::time_point t = {}) : kind(k), until(t) {}
+
+    public:
+        // 让出CPU，保持就绪。
+        static TaskStatus yield() { return TaskStatus(YIELD); }
+
+        // 休眠一段时间后重新就绪。
+        template<typename _Rep, typename _Period>
+        static TaskStatus sleep(const std::chrono::duration<_Rep, _Period> &dt) {
+            return TaskStatus(SLEEP, std::chrono::steady_clock::now() + dt);
+        }
+
+        // 挂起，直到被Scheduler::wake唤醒。
+        static TaskStatus wait() { return TaskStatus(WAIT); }
+
+        // 结束任务。
+        static TaskStatus exit() { return TaskStatus(EXIT); }
+    };
+
+    /* 优先级协作式调度器
+     * 参照RT-Thread的就绪位图，在少量线程上运行大量轻量任务。
+     * 任务是返回TaskStatus的可调用对象，每次被调度执行一步，步与步之间即为抢占点：
+     * 消息等待应使用带0超时的pop，取不到数据时返回wait而不是阻塞线程，并通过wake_on在消息到达时唤醒任务。
+     * 优先级0~63，0为最高。通过BitMap::lowbit在O(1)时间内选出最高优先级的就绪任务，
+     * 同优先级的任务轮转执行。run()可以在一个或多个线程中同时调用。
+     */
+    class Scheduler {
+    public:
+        static constexpr std::size_t PRIORITY_NUM = BitMap<BITMAP_SIZE_64>::size;
+
+    private:
+        static constexpr std::size_t NIL = -1;
+
+        enum class TaskState {
+            READY = 0, RUNNING, SLEEPING, WAITING, DONE
+        };
+
+        struct Task {
+            std::string name;
+            std::function<TaskStatus()> func;
+            std::size_t priority;
+            TaskState state{TaskState::READY};
+            // 运行中被唤醒，本步结束后不再挂起。
+            bool wake_pending{false};
+            // 就绪链表的下一个任务
+            std::size_t next{NIL};
+        };
+
+        using Timer = std::pair<std::chrono::steady_clock::time_point, std::size_t>;
+
+        std::vector<std::unique_ptr<Task>> tasks;
+        // 就绪位图，第i位表示优先级i有就绪任务。
+        BitMap<BITMAP_SIZE_64> ready;
+        // 各优先级的就绪链表
+        std::size_t ready_head[PRIORITY_NUM], ready_tail[PRIORITY_NUM];
+        std::priority_queue<Timer, std::vector<Timer>, std::greater<>> timers;
+        std::size_t alive{0};
+        bool stopped{false};
+        std::mutex mtx;
+        std::condition_variable cv;
+
+        void make_ready(std::size_t id) {
+            auto &t = *tasks[id];
+            t.state = TaskState::READY;
+            t.next = NIL;
+            if (ready_head[t.priority] == NIL) ready_head[t.priority] = id;
+            else tasks[ready_tail[t.priority]]->next = id;
+            ready_tail[t.priority] = id;
+            ready.set_bit(t.priority);
+        }
+
+        std::size_t take_ready() {
+            auto prio = ready.lowbit();
+            auto id = ready_head[prio];
+            ready_head[prio] = tasks[id]->next;
+            if (ready_head[prio] == NIL) ready.clear_bit(prio);
+            return id;
+        }
+
+        void fire_timers() {
+            auto now = std::chrono::steady_clock::now();
+            while (!timers.empty() && timers.top().first <= now) {
+                auto id = timers.top().second;
+                timers.pop();
+                if (tasks[id]->state == TaskState::SLEEPING) make_ready(id);
+            }
+        }
+
+    public:
+        Scheduler() {
+            for (std::size_t i = 0; i < PRIORITY_NUM; i++) ready_head[i] = ready_tail[i] = NIL;
+        }
+
+        Scheduler(const Scheduler &) = delete;
+
+        Scheduler &operator=(const Scheduler &) = delete;
+
+        // 创建一个就绪任务，返回任务id。
+        template<class F>
+        std::size_t create_task(const std::string &name, std::size_t priority, F &&func) {
+            if (priority >= PRIORITY_NUM) throw std::range_error("task priority out of range!");
+            std::unique_lock lock(mtx);
+            auto id = tasks.size();
+            tasks.emplace_back(new Task{name, std::function<TaskStatus()>(std::forward<F>(func)), priority});
+            alive++;
+            make_ready(id);
+            cv.notify_one();
+            return id;
+        }
+
+        // 唤醒处于wait状态的任务，可以在任意线程中调用。
+        void wake(std::size_t id) {
+            std::unique_lock lock(mtx);
+            if (id >= tasks.size()) return;
+            auto &t = *tasks[id];
+            if (t.state == TaskState::WAITING) {
+                make_ready(id);
+                cv.notify_one();
+            } else if (t.state == TaskState::RUNNING) {
+                t.wake_pending = true;
+            }
+        }
+
+        /* 订阅者收到消息、被断开或失去所有发布者时唤醒任务。仅MultiMessage的订阅者支持。
+         * 任务pop取不到数据时返回TaskStatus::wait()即可，不需要轮询；pop之后到达的消息不会丢失唤醒。
+         * 调度器的生命周期必须大于订阅者。
+         */
+        template<class S>
+        void wake_on(S &sub, std::size_t id) {
+            sub.set_notify([this, id]() { wake(id); });
+        }
+
+        // 停止所有run()，未结束的任务保持原状态。
+        void stop() {
+            std::unique_lock lock(mtx);
+            stopped = true;
+            cv.notify_all();
+        }
+
+        // 在当前线程中执行调度，直到stop()或者所有任务结束。
+        void run() {
+            std::unique_lock lock(mtx);
+            while (!stopped && alive > 0) {
+                fire_timers();
+                if (ready == 0) {
+                    if (timers.empty()) cv.wait(lock);
+                    else cv.wait_until(lock, timers.top().first);
+                    continue;
+                }
+                auto id = take_ready();
+                auto &t = *tasks[id];
+                t.state = TaskState::RUNNING;
+                t.wake_pending = false;
+                lock.unlock();
+                TaskStatus status = TaskStatus::exit();
+                try {
+                    status = t.func();
+                } catch (...) {
+                    // 任务抛出异常时结束该任务，使其他run()不会永远等待，然后继续抛出。
+                    lock.lock();
+                    t.state = TaskState::DONE;
+                    t.func = nullptr;
+                    if (--alive == 0) cv.notify_all();
+                    else if (ready != 0 || !timers.empty()) cv.notify_one();
+                    throw;
+                }
+                lock.lock();
+                switch (status.kind) {
+                    case TaskStatus::YIELD:
+                        make_ready(id);
+                        break;
+                    case TaskStatus::SLEEP:
+                        t.state = TaskState::SLEEPING;
+                        timers.emplace(status.until, id);
+                        break;
+                    case TaskStatus::WAIT:
+                        if (t.wake_pending) make_ready(id);
+                        else t.state = TaskState::WAITING;
+                        break;
+                    case TaskStatus::EXIT:
+                        t.state = TaskState::DONE;
+                        t.func = nullptr;
+                        if (--alive == 0) cv.notify_all();
+                        break;
+                }
+                // 其他线程可能在等待刚刚就绪或者更早到期的任务。
+                if (ready != 0 || !timers.empty()) cv.notify_one();
+            }
+        }
+
+        std::size_t get_task_num() {
+            std::unique_lock lock(mtx);
+            return alive;
+        }
+    };
+}
+
+#endif /* TOS_SCHEDULER_H */
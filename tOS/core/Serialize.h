@@ -0,0 +1,223 @@
+//
+// Created by xinyang on 2020/9/15.
+//
+
+#ifndef TOS_SERIALIZE_H
+#define TOS_SERIALIZE_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <type_traits>
+
+/* 在结构体内声明需要序列化的成员，按声明顺序序列化。
+ * struct Foo {
+ *     int a;
+ *     std::vector<float> b;
+ *     TOS_REFLECT(a, b)
+ * };
+ */
+#define TOS_REFLECT(...)                                                    \
+    static constexpr const char *tos_field_names = #__VA_ARGS__;            \
+    auto tos_fields() { return std::tie(__VA_ARGS__); }                     \
+    auto tos_fields() const { return std::tie(__VA_ARGS__); }
+
+namespace tOS {
+    /* 序列化器
+     * 可平凡复制的类型直接按内存拷贝，可以零拷贝访问。
+     * std::string、std::vector使用varint长度前缀的紧凑编码。
+     * 使用TOS_REFLECT声明成员的结构体按成员逐个序列化。
+     * 其他类型可以通过特化Serializer支持，需提供size、write、read三个静态函数。
+     */
+    template<class T, class = void>
+    struct Serializer {
+        static constexpr bool valid = false;
+    };
+
+    // 用于判断一个类型是否可以序列化。
+    template<class T>
+    constexpr bool isSerializable = Serializer<T>::valid;
+
+    // 用于判断一个类型是否使用TOS_REFLECT声明了成员。
+    template<class T, class = void>
+    constexpr bool isReflected = false;
+
+    template<class T>
+    constexpr bool isReflected<T, std::void_t<decltype(std::declval<T &>().tos_fields())>> = true;
+
+    /***** varint编码，每字节低7位为数据，最高位表示后面是否还有字节 *****/
+    inline std::size_t varint_size(std::uint64_t v) {
+        std::size_t n = 1;
+        while (v >= 0x80) v >>= 7, n++;
+        return n;
+    }
+
+    inline unsigned char *varint_write(std::uint64_t v, unsigned char *p) {
+        while (v >= 0x80) {
+            *p++ = static_cast<unsigned char>(v | 0x80);
+            v >>= 7;
+        }
+        *p++ = static_cast<unsigned char>(v);
+        return p;
+    }
+
+    inline bool varint_read(std::uint64_t &v, const unsigned char *&p, const unsigned char *end) {
+        v = 0;
+        for (int shift = 0; shift < 64 && p < end; shift += 7) {
+            auto b = *p++;
+            v |= static_cast<std::uint64_t>(b & 0x7f) << shift;
+            if ((b & 0x80) == 0) return true;
+        }
+        return false;
+    }
+
+    // 可平凡复制的类型
+    template<class T>
+    struct Serializer<T, std::enable_if_t<std::is_trivially_copyable_v<T>>> {
+        static constexpr bool valid = true;
+
+        static std::size_t size(const T &) { return sizeof(T); }
+
+        static unsigned char *write(const T &obj, unsigned char *p) {
+            std::memcpy(p, &obj, sizeof(T));
+            return p + sizeof(T);
+        }
+
+        static bool read(T &obj, const unsigned char *&p, const unsigned char *end) {
+            if (end - p < static_cast<std::ptrdiff_t>(sizeof(T))) return false;
+            std::memcpy(&obj, p, sizeof(T));
+            p += sizeof(T);
+            return true;
+        }
+    };
+
+    // 字符串
+    template<class C, class Traits, class A>
+    struct Serializer<std::basic_string<C, Traits, A>, std::enable_if_t<std::is_trivially_copyable_v<C>>> {
+        using S = std::basic_string<C, Traits, A>;
+        static constexpr bool valid = true;
+
+        static std::size_t size(const S &obj) {
+            return varint_size(obj.size()) + obj.size() * sizeof(C);
+        }
+
+        static unsigned char *write(const S &obj, unsigned char *p) {
+            p = varint_write(obj.size(), p);
+            std::memcpy(p, obj.data(), obj.size() * sizeof(C));
+            return p + obj.size() * sizeof(C);
+        }
+
+        static bool read(S &obj, const unsigned char *&p, const unsigned char *end) {
+            std::uint64_t n;
+            if (!varint_read(n, p, end)) return false;
+            if (static_cast<std::uint64_t>(end - p) / sizeof(C) < n) return false;
+            obj.resize(n);
+            std::memcpy(obj.data(), p, n * sizeof(C));
+            p += n * sizeof(C);
+            return true;
+        }
+    };
+
+    // 动态数组，元素可平凡复制时整块拷贝。
+    template<class U, class A>
+    struct Serializer<std::vector<U, A>, std::enable_if_t<isSerializable<U>>> {
+        using V = std::vector<U, A>;
+        static constexpr bool valid = true;
+
+        static std::size_t size(const V &obj) {
+            if constexpr(std::is_trivially_copyable_v<U>) {
+                return varint_size(obj.size()) + obj.size() * sizeof(U);
+            } else {
+                std::size_t n = varint_size(obj.size());
+                for (auto &v: obj) n += Serializer<U>::size(v);
+                return n;
+            }
+        }
+
+        static unsigned char *write(const V &obj, unsigned char *p) {
+            p = varint_write(obj.size(), p);
+            if constexpr(std::is_trivially_copyable_v<U>) {
+                if (!obj.empty()) std::memcpy(p, obj.data(), obj.size() * sizeof(U));
+                return p + obj.size() * sizeof(U);
+            } else {
+                for (auto &v: obj) p = Serializer<U>::write(v, p);
+                return p;
+            }
+        }
+
+        static bool read(V &obj, const unsigned char *&p, const unsigned char *end) {
+            std::uint64_t n;
+            if (!varint_read(n, p, end)) return false;
+            if constexpr(std::is_trivially_copyable_v<U>) {
+                if (static_cast<std::uint64_t>(end - p) / sizeof(U) < n) return false;
+                obj.resize(n);
+                if (n != 0) std::memcpy(obj.data(), p, n * sizeof(U));
+                p += n * sizeof(U);
+                return true;
+            } else {
+                // 每个元素至少占用一个字节，先做长度检查防止恶意数据导致超大分配。
+                if (static_cast<std::uint64_t>(end - p) < n) return false;
+                obj.resize(n);
+                for (auto &v: obj) if (!Serializer<U>::read(v, p, end)) return false;
+                return true;
+            }
+        }
+    };
+
+    // 使用TOS_REFLECT声明成员的结构体
+    template<class T>
+    struct Serializer<T, std::enable_if_t<!std::is_trivially_copyable_v<T> && isReflected<T>>> {
+        static constexpr bool valid = true;
+
+        static std::size_t size(const T &obj) {
+            return std::apply([](auto &...fs) {
+                return (std::size_t(0) + ... + Serializer<std::decay_t<decltype(fs)>>::size(fs));
+            }, obj.tos_fields());
+        }
+
+        static unsigned char *write(const T &obj, unsigned char *p) {
+            std::apply([&p](auto &...fs) {
+                ((p = Serializer<std::decay_t<decltype(fs)>>::write(fs, p)), ...);
+            }, obj.tos_fields());
+            return p;
+        }
+
+        static bool read(T &obj, const unsigned char *&p, const unsigned char *end) {
+            return std::apply([&](auto &...fs) {
+                return (... && Serializer<std::decay_t<decltype(fs)>>::read(fs, p, end));
+            }, obj.tos_fields());
+        }
+    };
+
+    // 序列化到buf末尾，返回写入的字节数。
+    template<class T>
+    std::size_t serialize(const T &obj, std::vector<unsigned char> &buf) {
+        static_assert(isSerializable<T>, "T is not serializable.");
+        auto n = Serializer<T>::size(obj);
+        auto old = buf.size();
+        buf.resize(old + n);
+        Serializer<T>::write(obj, buf.data() + old);
+        return n;
+    }
+
+    // 反序列化，数据不完整或有多余数据时返回false。
+    template<class T>
+    bool deserialize(T &obj, const void *data, std::size_t size) {
+        static_assert(isSerializable<T>, "T is not serializable.");
+        auto *p = static_cast<const unsigned char *>(data);
+        auto *end = p + size;
+        return Serializer<T>::read(obj, p, end) && p == end;
+    }
+
+    // 可平凡复制类型的零拷贝访问，数据长度或对齐不满足时返回nullptr。
+    template<class T>
+    const T *serial_view(const void *data, std::size_t size) {
+        static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable type can be viewed.");
+        if (size != sizeof(T) || reinterpret_cast<std::uintptr_t>(data) % alignof(T) != 0) return nullptr;
+        return static_cast<const T *>(data);
+    }
+}
+
+#endif /* TOS_SERIALIZE_H */
@@ -0,0 +1,397 @@
+//
+// Created by xinyang on 2020/10/2.
+//
+
+#ifndef TOS_STREAM_H
+#define TOS_STREAM_H
+
+#include "../tOS_config.h"
+#include "../utils/CircularQueue.h"
+#include "Request.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace tOS {
+    enum class StreamStatus {
+        OK = 0,     // 正常
+        TIMEOUT,    // 超时
+        END,        // 写端正常结束，数据已读完
+        ABORTED     // 一端提前放弃，读端不再读取或写端未正常结束
+    };
+
+    /* 有界单生产者单消费者通道
+     * 缓冲区满时写端阻塞，即流量控制，内存占用不超过window个元素。
+     * 缓冲区在第一次写入时才分配。
+     */
+    template<class T>
+    class Channel {
+    private:
+        using time_point = std::chrono::steady_clock::time_point;
+
+        CircularQueue<T, DYNAMIC_SIZE, false> q;
+        // OK表示通道打开，否则为通道关闭的原因。
+        StreamStatus state{StreamStatus::OK};
+        std::mutex mtx;
+        std::condition_variable readable, writable;
+
+        // until为nullptr时一直等待。
+        template<class Pred>
+        static bool wait(std::unique_lock<std::mutex> &lock, std::condition_variable &cv,
+                         const time_point *until, Pred pred) {
+            if (until == nullptr) {
+                cv.wait(lock, pred);
+                return true;
+            }
+            return cv.wait_until(lock, *until, pred);
+        }
+
+    public:
+        explicit Channel(std::size_t window) : q(std::max<std::size_t>(window, 1), std::max<std::size_t>(window, 1)) {}
+
+        template<class U>
+        StreamStatus write(U &&obj, const time_point *until) {
+            std::unique_lock lock(mtx);
+            if (!wait(lock, writable, until, [this]() { return !q.full() || state != StreamStatus::OK; }))
+                return StreamStatus::TIMEOUT;
+            if (state != StreamStatus::OK) return StreamStatus::ABORTED;
+            q.push(std::forward<U>(obj));
+            readable.notify_one();
+            return StreamStatus::OK;
+        }
+
+        StreamStatus read(std::optional<T> &obj, const time_point *until) {
+            std::unique_lock lock(mtx);
+            if (!wait(lock, readable, until, [this]() { return !q.empty() || state != StreamStatus::OK; }))
+                return StreamStatus::TIMEOUT;
+            // 写端关闭后仍然可以读完已写入的数据。
+            if (q.empty()) return state;
+            obj.emplace(q.pop());
+            writable.notify_one();
+            return StreamStatus::OK;
+        }
+
+        // 关闭通道，已经关闭时保持原来的原因。
+        void close(StreamStatus s) {
+            std::unique_lock lock(mtx);
+            if (state == StreamStatus::OK) state = s;
+            readable.notify_all();
+            writable.notify_all();
+        }
+
+        StreamStatus status() {
+            std::unique_lock lock(mtx);
+            return state;
+        }
+    };
+
+    /* 通道写端
+     * finish()正常结束，未调用finish()就析构时读端得到ABORTED。
+     */
+    template<class T>
+    class StreamWriter {
+    private:
+        std::shared_ptr<Channel<T>> ch;
+    public:
+        using ValType = T;
+
+        ~StreamWriter() {
+            if (ch) ch->close(StreamStatus::ABORTED);
+        }
+
+        StreamWriter() = default;
+
+        explicit StreamWriter(std::shared_ptr<Channel<T>> c) : ch(std::move(c)) {}
+
+        StreamWriter(const StreamWriter &p) = delete;
+
+        StreamWriter(StreamWriter &&p) = default;
+
+        StreamWriter &operator=(const StreamWriter &p) = delete;
+
+        StreamWriter &operator=(StreamWriter &&p) {
+            if (ch) ch->close(StreamStatus::ABORTED);
+            ch = std::move(p.ch);
+            return *this;
+        }
+
+        operator bool() const { return ch != nullptr; }
+
+        // 缓冲区满时阻塞，读端放弃、已经finish()或写端已被移走时返回ABORTED。
+        inline StreamStatus write(const T &obj) {
+            if (!ch) return StreamStatus::ABORTED;
+            return ch->write(obj, nullptr);
+        }
+
+        inline StreamStatus write(T &&obj) {
+            if (!ch) return StreamStatus::ABORTED;
+            return ch->write(std::move(obj), nullptr);
+        }
+
+        template<typename _Rep, typename _Period>
+        inline StreamStatus write_for(const T &obj, const std::chrono::duration<_Rep, _Period> &dt) {
+            if (!ch) return StreamStatus::ABORTED;
+            auto until = std::chrono::steady_clock::now() + dt;
+            return ch->write(obj, &until);
+        }
+
+        template<typename _Rep, typename _Period>
+        inline StreamStatus write_for(T &&obj, const std::chrono::duration<_Rep, _Period> &dt) {
+            if (!ch) return StreamStatus::ABORTED;
+            auto until = std::chrono::steady_clock::now() + dt;
+            return ch->write(std::move(obj), &until);
+        }
+
+        // 读端是否已经放弃，此时继续写入没有意义。
+        inline bool aborted() const { return ch == nullptr || ch->status() == StreamStatus::ABORTED; }
+
+        // 正常结束写入。
+        inline void finish() {
+            if (!ch) return;
+            ch->close(StreamStatus::END);
+            ch.reset();
+        }
+    };
+
+    /* 通道读端
+     * 支持范围for循环逐个读取，直到写端结束。析构或调用cancel()时写端得到ABORTED。
+     */
+    template<class T>
+    class StreamReader {
+    private:
+        std::shared_ptr<Channel<T>> ch;
+        StreamStatus last{StreamStatus::OK};
+
+        inline StreamStatus read(std::optional<T> &obj, const std::chrono::steady_clock::time_point *until) {
+            if (!ch) return last = StreamStatus::ABORTED;
+            return last = ch->read(obj, until);
+        }
+
+    public:
+        using ValType = T;
+
+        class iterator {
+        private:
+            StreamReader *r{nullptr};
+            std::optional<T> val;
+        public:
+            iterator() = default;
+
+            explicit iterator(StreamReader *_r) : r(_r) { ++*this; }
+
+            inline iterator &operator++() {
+                if (r->read(val, nullptr) != StreamStatus::OK) r = nullptr;
+                return *this;
+            }
+
+            inline T &operator*() { return *val; }
+
+            inline T *operator->() { return &*val; }
+
+            inline bool operator==(const iterator &o) const { return r == o.r; }
+
+            inline bool operator!=(const iterator &o) const { return r != o.r; }
+        };
+
+        ~StreamReader() {
+            cancel();
+        }
+
+        StreamReader() = default;
+
+        explicit StreamReader(std::shared_ptr<Channel<T>> c) : ch(std::move(c)) {}
+
+        StreamReader(const StreamReader &p) = delete;
+
+        StreamReader(StreamReader &&p) = default;
+
+        StreamReader &operator=(const StreamReader &p) = delete;
+
+        StreamReader &operator=(StreamReader &&p) {
+            cancel();
+            ch = std::move(p.ch);
+            last = p.last;
+            return *this;
+        }
+
+        operator bool() const { return ch != nullptr; }
+
+        // 没有数据时阻塞，写端结束后返回END或ABORTED。
+        inline StreamStatus read(T &obj) {
+            std::optional<T> v;
+            auto s = read(v, nullptr);
+            if (s == StreamStatus::OK) obj = std::move(*v);
+            return s;
+        }
+
+        template<typename _Rep, typename _Period>
+        inline StreamStatus read_for(T &obj, const std::chrono::duration<_Rep, _Period> &dt) {
+            auto until = std::chrono::steady_clock::now() + dt;
+            std::optional<T> v;
+            auto s = read(v, &until);
+            if (s == StreamStatus::OK) obj = std::move(*v);
+            return s;
+        }
+
+        inline iterator begin() { return iterator(this); }
+
+        inline iterator end() { return iterator(); }
+
+        // 最近一次读取的结果，范围for循环结束后用于区分正常结束和异常中止。
+        inline StreamStatus status() const { return last; }
+
+        // 放弃读取，写端之后的写入返回ABORTED。
+        inline void cancel() {
+            if (!ch) return;
+            ch->close(StreamStatus::ABORTED);
+            ch.reset();
+        }
+    };
+
+    // 创建一个缓冲window个元素的通道，返回写端和读端。
+    template<class T>
+    std::pair<StreamWriter<T>, StreamReader<T>> make_stream(std::size_t window = TOS_STREAM_WINDOW_DEFAULT) {
+        auto ch = std::make_shared<Channel<T>>(window);
+        return {StreamWriter<T>(ch), StreamReader<T>(ch)};
+    }
+
+    // 流式请求中服务端得到的一次调用。
+    template<class S, class B>
+    struct StreamCall {
+        using InType = S;
+        using OutType = B;
+        // 客户端发来的请求流
+        StreamReader<S> in;
+        // 返回给客户端的结果流
+        StreamWriter<B> out;
+    };
+
+    /* 流式请求包，每次调用都有一对独立的有界通道，服务端逐个写入结果，客户端逐个读取。
+     * 复用Request的分发、截止时间和AQM，容器只支持CIRCULAR_QUEUE和STACK。
+     * S: 请求元素类型
+     * B: 结果元素类型
+     */
+    template<class S, class B, std::size_t SIZE = 1, ContainerEnum Container = CIRCULAR_QUEUE>
+    using StreamRequest = Request<StreamCall<S, B>, void, SIZE, Container>;
+
+    // 用于判断一个类型是否为容器合法的流式请求包。调用没有优先级和截止时间，不支持PRIORITY和EDF。
+    template<class T>
+    constexpr bool isStreamRequest = false;
+
+    template<class S, class B, std::size_t SIZE, ContainerEnum Container>
+    constexpr bool isStreamRequest<Request<StreamCall<S, B>, void, SIZE, Container>> =
+            Container == CIRCULAR_QUEUE || Container == STACK;
+
+    /* 流式请求客户端
+     * R: 流式请求包类型
+     */
+    template<class R>
+    class StreamClient {
+        static_assert(isStreamRequest<R>, "R must be StreamRequest with CIRCULAR_QUEUE or STACK container.");
+    private:
+        Client<R> c;
+
+        using Call = typename Client<R>::SendType;
+        using S = typename Call::InType;
+        using B = typename Call::OutType;
+
+        template<class Push>
+        StreamReader<B> call_with(S &&req, std::size_t window, Push push) {
+            auto[in_w, in_r] = make_stream<S>(1);
+            in_w.write(std::move(req));
+            in_w.finish();
+            auto[out_w, out_r] = make_stream<B>(window);
+            // 请求被丢弃时结果流的写端随之析构，读端得到ABORTED，无需通过future等待。
+            push(Call{std::move(in_r), std::move(out_w)}).detach();
+            return std::move(out_r);
+        }
+
+    public:
+        StreamClient() = default;
+
+        StreamClient(Client<R> &&_c) : c(std::move(_c)) {}
+
+        operator bool() { return c; }
+
+        // 服务端流：发送一个请求，返回结果流。window: 结果流的缓冲个数，也即流量控制窗口
+        StreamReader<B> call(S req, std::size_t window = TOS_STREAM_WINDOW_DEFAULT) {
+            return call_with(std::move(req), window, [this](Call &&call) { return c.push(std::move(call)); });
+        }
+
+        // 带截止时间的服务端流，dt时间内未被服务端取走时结果流以ABORTED结束。
+        template<typename _Rep, typename _Period>
+        StreamReader<B> call_for(S req, const std::chrono::duration<_Rep, _Period> &dt,
+                                 std::size_t window = TOS_STREAM_WINDOW_DEFAULT) {
+            return call_with(std::move(req), window, [this, &dt](Call &&call) {
+                return c.push_for(std::move(call), dt);
+            });
+        }
+
+        // 双向流：返回请求流的写端和结果流的读端，两个方向分别进行流量控制。
+        std::pair<StreamWriter<S>, StreamReader<B>> open(std::size_t in_window = TOS_STREAM_WINDOW_DEFAULT,
+                                                         std::size_t out_window = TOS_STREAM_WINDOW_DEFAULT) {
+            auto[in_w, in_r] = make_stream<S>(in_window);
+            auto[out_w, out_r] = make_stream<B>(out_window);
+            c.push(Call{std::move(in_r), std::move(out_w)}).detach();
+            return {std::move(in_w), std::move(out_r)};
+        }
+
+        inline void reset() { c.reset(); }
+    };
+
+    /* 流式请求服务端
+     * R: 流式请求包类型
+     */
+    template<class R>
+    class StreamServer {
+        static_assert(isStreamRequest<R>, "R must be StreamRequest with CIRCULAR_QUEUE or STACK container.");
+    private:
+        Server<R> s;
+
+    public:
+        using Call = typename Client<R>::SendType;
+
+        StreamServer() = default;
+
+        StreamServer(Server<R> &&_s) : s(std::move(_s)) {}
+
+        operator bool() { return s; }
+
+        // 取出一次调用，跳过客户端已经放弃读取的调用。
+        bool pop(Call &call) {
+            typename Server<R>::T t;
+            while (true) {
+                s.pop(t);
+                t.second.set_value();
+                if (t.first.out.aborted()) continue;
+                call = std::move(t.first);
+                return true;
+            }
+        }
+
+        template<typename _Rep, typename _Period>
+        bool pop(Call &call, const std::chrono::duration<_Rep, _Period> &dt) {
+            auto until = std::chrono::steady_clock::now() + dt;
+            typename Server<R>::T t;
+            while (true) {
+                if (!s.pop(t, until - std::chrono::steady_clock::now())) return false;
+                t.second.set_value();
+                if (t.first.out.aborted()) continue;
+                call = std::move(t.first);
+                return true;
+            }
+        }
+
+        inline void set_dispatch(DispatchPolicy policy) { s.set_dispatch(policy); }
+
+        inline CallStat get_call_stat() { return s.get_call_stat(); }
+
+        inline void reset() { s.reset(); }
+    };
+}
+
+#endif /* TOS_STREAM_H */
@@ -6,16 +6,28 @@
 #define TOS_SYNC_H
 
 #include <condition_variable>
+#include <initializer_list>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <mutex>
+#include <type_traits>
 
 namespace tOS {
 
+    // 用于判断一个类型能否使用无锁Sync。
+    template<class T, bool = std::is_trivially_copyable_v<T>>
+    constexpr bool isAtomicSync = false;
+
+    template<class T>
+    constexpr bool isAtomicSync<T, true> = std::atomic<T>::is_always_lock_free;
+
     /*
      * 用于多任务同步
      * 典型的condition_variable的应用
      * 用于某个任务等待某个特定的标志
      */
-    template<class T>
+    template<class T, class = void>
     class Sync {
         T val;
         std::mutex mtx;
@@ -25,6 +37,11 @@ namespace tOS {
         template<class ...Ts>
         explicit Sync(Ts &&... objs) : val(std::forward<Ts>(objs)...) {}
 
+        T get() {
+            std::unique_lock lock(mtx);
+            return val;
+        }
+
         void update(const T &v) {
             std::unique_lock lock(mtx);
             if (v != val) {
@@ -42,8 +59,131 @@ namespace tOS {
         }
 
         void wait(const T &v) {
+            wait_if([&](const T &cur) { return cur == v; });
+        }
+
+        template<typename _Rep, typename _Period>
+        bool wait_for(const T &v, const std::chrono::duration<_Rep, _Period> &dt) {
+            return wait_if_until([&](const T &cur) { return cur == v; }, std::chrono::steady_clock::now() + dt);
+        }
+
+        template<typename _Clock, typename _Duration>
+        bool wait_until(const T &v, const std::chrono::time_point<_Clock, _Duration> &tp) {
+            return wait_if_until([&](const T &cur) { return cur == v; }, tp);
+        }
+
+        // 等待标志满足条件pred
+        template<class Pred>
+        void wait_if(Pred pred) {
+            std::unique_lock lock(mtx);
+            cv.wait(lock, [&]() { return pred(val); });
+        }
+
+        template<class Pred, typename _Rep, typename _Period>
+        bool wait_if_for(Pred pred, const std::chrono::duration<_Rep, _Period> &dt) {
+            return wait_if_until(pred, std::chrono::steady_clock::now() + dt);
+        }
+
+        template<class Pred, typename _Clock, typename _Duration>
+        bool wait_if_until(Pred pred, const std::chrono::time_point<_Clock, _Duration> &tp) {
+            std::unique_lock lock(mtx);
+            return cv.wait_until(lock, tp, [&]() { return pred(val); });
+        }
+
+        // 等待标志变为vs中的任意一个值，返回当时的标志
+        T wait_any(std::initializer_list<T> vs) {
             std::unique_lock lock(mtx);
-            cv.wait(lock, [&]() { return val == v; });
+            cv.wait(lock, [&]() { return std::find(vs.begin(), vs.end(), val) != vs.end(); });
+            return val;
+        }
+
+        template<typename _Rep, typename _Period>
+        bool wait_any_for(std::initializer_list<T> vs, const std::chrono::duration<_Rep, _Period> &dt) {
+            return wait_if_for([&](const T &cur) { return std::find(vs.begin(), vs.end(), cur) != vs.end(); }, dt);
+        }
+    };
+
+    /*
+     * 无锁Sync，用于char、枚举等可以无锁原子操作的标志
+     * 标志的读写都是原子操作，标志已满足时等待不需要加锁；
+     * 只有存在等待者时更新才会加锁并唤醒（一次notify_all）。
+     */
+    template<class T>
+    class Sync<T, std::enable_if_t<isAtomicSync<T>>> {
+        std::atomic<T> val;
+        // 正在阻塞等待的任务个数
+        std::atomic_size_t waiters{0};
+        std::mutex mtx;
+        std::condition_variable cv;
+
+        void notify() {
+            if (waiters.load() == 0) return;
+            // 加锁保证等待者要么还未检查条件，要么已经进入等待，避免丢失唤醒。
+            { std::unique_lock lock(mtx); }
+            cv.notify_all();
+        }
+
+    public:
+        template<class ...Ts>
+        explicit Sync(Ts &&... objs) : val(T(std::forward<Ts>(objs)...)) {}
+
+        T get() const {
+            return val.load(std::memory_order_acquire);
+        }
+
+        void update(const T &v) {
+            if (val.exchange(v) != v) notify();
+        }
+
+        void wait(const T &v) {
+            wait_if([&](const T &cur) { return cur == v; });
+        }
+
+        template<typename _Rep, typename _Period>
+        bool wait_for(const T &v, const std::chrono::duration<_Rep, _Period> &dt) {
+            return wait_if_until([&](const T &cur) { return cur == v; }, std::chrono::steady_clock::now() + dt);
+        }
+
+        template<typename _Clock, typename _Duration>
+        bool wait_until(const T &v, const std::chrono::time_point<_Clock, _Duration> &tp) {
+            return wait_if_until([&](const T &cur) { return cur == v; }, tp);
+        }
+
+        // 等待标志满足条件pred
+        template<class Pred>
+        void wait_if(Pred pred) {
+            if (pred(get())) return;
+            waiters++;
+            std::unique_lock lock(mtx);
+            cv.wait(lock, [&]() { return pred(val.load()); });
+            waiters--;
+        }
+
+        template<class Pred, typename _Rep, typename _Period>
+        bool wait_if_for(Pred pred, const std::chrono::duration<_Rep, _Period> &dt) {
+            return wait_if_until(pred, std::chrono::steady_clock::now() + dt);
+        }
+
+        template<class Pred, typename _Clock, typename _Duration>
+        bool wait_if_until(Pred pred, const std::chrono::time_point<_Clock, _Duration> &tp) {
+            if (pred(get())) return true;
+            waiters++;
+            std::unique_lock lock(mtx);
+            bool ret = cv.wait_until(lock, tp, [&]() { return pred(val.load()); });
+            waiters--;
+            return ret;
+        }
+
+        // 等待标志变为vs中的任意一个值，返回当时的标志
+        T wait_any(std::initializer_list<T> vs) {
+            T cur = get();
+            wait_if([&](const T &v) { return std::find(vs.begin(), vs.end(), cur = v) != vs.end(); });
+            return cur;
+        }
+
+        template<typename _Rep, typename _Period>
+        bool wait_any_for(std::initializer_list<T> vs, const std::chrono::duration<_Rep, _Period> &dt) {
+            return wait_if_for([&](const T &cur) { return std::find(vs.begin(), vs.end(), cur) != vs.end(); }, dt);
         }
     };
 }
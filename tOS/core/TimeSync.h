@@ -0,0 +1,194 @@
+//
+// Created by xinyang on 2020/10/4.
+//
+
+#ifndef TOS_TIMESYNC_H
+#define TOS_TIMESYNC_H
+
+#include "../tOS_config.h"
+#include "../utils/CircularQueue.h"
+#include "Message.h"
+#include <array>
+#include <chrono>
+#include <tuple>
+#include <utility>
+
+namespace tOS {
+    /* 近似时间同步器，将多个话题中时间戳相近的消息组合在一起输出，用于多传感器融合。
+     * 消息需提供可比较、可相减的成员stamp，各话题的stamp类型相同，且每个话题按时间戳顺序发布。
+     * 以各话题最旧消息中最晚的时间戳为基准，在其他话题中二分查找最接近的消息，
+     * 与基准的时间差都不超过tolerance时输出一组，并丢弃各话题中更旧的消息。
+     * 每个话题的缓冲区大小固定，满时丢弃最旧的消息。
+     * Subs: 各话题的订阅器类型
+     */
+    template<class ...Subs>
+    class TimeSynchronizer {
+        static_assert(sizeof...(Subs) >= 2, "TimeSynchronizer needs at least two subscribers.");
+    public:
+        using ValType = std::tuple<typename Subs::ValType...>;
+    private:
+        static constexpr std::size_t N = sizeof...(Subs);
+        using Index = std::make_index_sequence<N>;
+        using Stamp = std::decay_t<decltype(std::declval<const std::tuple_element_t<0, ValType> &>().stamp)>;
+    public:
+        using Tolerance = decltype(std::declval<Stamp>() - std::declval<Stamp>());
+    private:
+        using time_point = std::chrono::steady_clock::time_point;
+
+        // 容量固定为depth的循环队列
+        template<class T>
+        struct Buffer : public CircularQueue<T, DYNAMIC_SIZE, false> {
+            explicit Buffer(std::size_t depth) : CircularQueue<T, DYNAMIC_SIZE, false>(depth, depth) {}
+        };
+
+        template<std::size_t I>
+        using Ring = Buffer<std::tuple_element_t<I, ValType>>;
+
+        std::tuple<Subs...> subs;
+        std::tuple<Buffer<typename Subs::ValType>...> rings;
+        Tolerance tolerance;
+        // 乱序、缓冲区满或无法匹配而丢弃的消息数
+        std::size_t dropped{0};
+
+        template<std::size_t I>
+        inline Ring<I> &ring() { return std::get<I>(rings); }
+
+        // s是否在t的容差范围内，与prune使用相同的比较，保证不匹配的消息一定会被丢弃。
+        inline bool within(const Stamp &s, const Stamp &t) const {
+            return !(s < t - tolerance) && !(t + tolerance < s);
+        }
+
+        // 第I个话题中与t最接近的消息的下标，缓冲区非空。
+        template<std::size_t I>
+        std::size_t nearest(const Stamp &t) {
+            auto &r = ring<I>();
+            std::size_t lo = 0, hi = r.size();
+            while (lo < hi) {
+                auto mid = (lo + hi) / 2;
+                if (r[mid].stamp < t) lo = mid + 1;
+                else hi = mid;
+            }
+            if (lo == r.size()) return lo - 1;
+            if (lo > 0 && t - r[lo - 1].stamp <= r[lo].stamp - t) return lo - 1;
+            return lo;
+        }
+
+        template<std::size_t I>
+        void store(std::tuple_element_t<I, ValType> &&obj) {
+            auto &r = ring<I>();
+            if (!r.empty() && obj.stamp < r[r.size() - 1].stamp) {
+                dropped++;
+                return;
+            }
+            if (r.full()) {
+                r.pop();
+                dropped++;
+            }
+            r.push(std::move(obj));
+        }
+
+        // 丢弃第I个话题中的前n个消息。
+        template<std::size_t I>
+        void discard(std::size_t n) {
+            for (std::size_t i = 0; i < n; i++) ring<I>().pop();
+        }
+
+        // 非阻塞地取出第I个订阅器中已有的消息。
+        template<std::size_t I>
+        void poll() {
+            std::tuple_element_t<I, ValType> obj;
+            while (std::get<I>(subs).pop(obj, std::chrono::nanoseconds(0)) == MessageStatus::OK)
+                store<I>(std::move(obj));
+        }
+
+        // 阻塞地从第I个订阅器取一个消息，until为nullptr时一直等待。
+        template<std::size_t I>
+        MessageStatus wait(const time_point *until) {
+            std::tuple_element_t<I, ValType> obj;
+            auto s = until == nullptr ? std::get<I>(subs).pop(obj)
+                                      : std::get<I>(subs).pop(obj, *until - std::chrono::steady_clock::now());
+            if (s == MessageStatus::OK) store<I>(std::move(obj));
+            return s;
+        }
+
+        // 尝试匹配一组消息，失败时至少有一个话题的缓冲区为空。
+        template<std::size_t ...Is>
+        bool match(ValType &out, std::index_sequence<Is...>) {
+            while ((!ring<Is>().empty() && ...)) {
+                // 基准：各话题最旧消息中最晚的一个。
+                std::size_t pivot = 0;
+                Stamp t = ring<0>()[0].stamp;
+                ((ring<Is>()[0].stamp > t ? (t = ring<Is>()[0].stamp, pivot = Is) : 0), ...);
+                std::array<std::size_t, N> idx{nearest<Is>(t)...};
+                if ((within(ring<Is>()[idx[Is]].stamp, t) && ...)) {
+                    ((std::get<Is>(out) = std::move(ring<Is>()[idx[Is]])), ...);
+                    (discard<Is>(idx[Is] + 1), ...);
+                    dropped += (idx[Is] + ...);
+                    return true;
+                }
+                // 之后的基准不会早于t，早于t - tolerance的消息不可能再被匹配。
+                bool popped = false;
+                ((popped |= prune<Is>(t)), ...);
+                // 某个话题在t附近没有消息且之后的消息更晚，基准消息不可能再被匹配。
+                if (!popped) {
+                    ((Is == pivot ? (discard<Is>(1), dropped++) : 0), ...);
+                }
+            }
+            return false;
+        }
+
+        template<std::size_t I>
+        bool prune(const Stamp &t) {
+            auto &r = ring<I>();
+            bool popped = false;
+            while (!r.empty() && r[0].stamp < t - tolerance) {
+                r.pop();
+                dropped++;
+                popped = true;
+            }
+            return popped;
+        }
+
+        template<std::size_t ...Is>
+        MessageStatus get(ValType &out, const time_point *until, std::index_sequence<Is...>) {
+            while (true) {
+                (poll<Is>(), ...);
+                if (match(out, Index())) return MessageStatus::OK;
+                // 在缓冲区为空的话题上等待。
+                auto s = MessageStatus::OK;
+                ((ring<Is>().empty() ? (s = wait<Is>(until), true) : false) || ...);
+                if (s != MessageStatus::OK) return s;
+            }
+        }
+
+    public:
+        /* tolerance: 同一组中各消息与基准的最大时间差
+         * subs: 各话题的订阅器，由同步器接管
+         * depth: 每个话题缓冲的消息个数
+         */
+        explicit TimeSynchronizer(Tolerance tol, Subs &&...s) :
+                TimeSynchronizer(tol, TOS_TIME_SYNC_DEPTH, std::move(s)...) {}
+
+        TimeSynchronizer(Tolerance tol, std::size_t depth, Subs &&...s) :
+                subs(std::move(s)...), rings(((void) sizeof(Subs), depth)...), tolerance(tol) {}
+
+        TimeSynchronizer(const TimeSynchronizer &) = delete;
+
+        TimeSynchronizer &operator=(const TimeSynchronizer &) = delete;
+
+        // 阻塞直到匹配到一组消息，某个话题的发布者都已退出时返回EMPTY。
+        MessageStatus pop(ValType &out) {
+            return get(out, nullptr, Index());
+        }
+
+        template<typename _Rep, typename _Period>
+        MessageStatus pop(ValType &out, const std::chrono::duration<_Rep, _Period> &dt) {
+            auto until = std::chrono::steady_clock::now() + dt;
+            return get(out, &until, Index());
+        }
+
+        inline std::size_t get_drop_num() const { return dropped; }
+    };
+}
+
+#endif /* TOS_TIMESYNC_H */
@@ -13,27 +13,6 @@
 using namespace tOS;
 using namespace tOS::service;
 
-// 通配符匹配
-static bool str_match(const char *str, const char *pattern) {
-    while (*pattern != 0) {
-        if (*str == 0) return false; // 无字符可匹配，匹配失败
-        switch (*pattern) {
-            case '?': // ?匹配单个任意字符
-                str++, pattern++;
-                break;
-            case '*': // *匹配任意个任意字符
-                while (*pattern == '*') pattern++; // 合并多个*
-                if (*pattern == 0) return true; // *后没有字符，必定匹配成功
-                while (*str != 0 && *str != *pattern) str++;
-                break;
-            default: // 匹配当前字符
-                if (*str++ != *pattern++) return false;
-        }
-    }
-    // 通配符结束，被匹配字符也应该结束，否则匹配失败
-    return *str == 0;
-}
-
 int list(int argc, const char *argv[]) {
     bool show_entry = false, show_cmd = false, show_obj = false;
     CLI::App app("list");
@@ -155,6 +134,167 @@ int stop(int argc, const char *argv[]) {
 
 CMD_EXPORT(stop);
 
+// 查看slab内存资源的占用情况
+int slab(int argc, const char *argv[]) {
+    std::string name = "*";
+    CLI::App app("slab");
+    app.add_option("resource", name, "the resource(s) to show, wildcard supported.");
+    CLI11_PARSE(app, argc, argv);
+
+    auto &m = obj_map[static_cast<int>(ObjType::RESOURCE)];
+    std::unique_lock lock(m.mtx);
+    for (auto &[n, v]: m.map) {
+        if (!str_match(n.c_str(), name.c_str())) continue;
+        tabulate::Table table;
+        table.add_row({n, "slabs", "blocks", "in use", "peak", "allocs"})[0].format()
+                .font_align(tabulate::FontAlign::center)
+                .font_background_color(tabulate::Color::green);
+        for (auto &s: static_cast<SlabResource *>(v.any)->stats()) {
+            table.add_row({s.block_size == 0 ? "large" : fmt::format("{}B", s.block_size),
+                           fmt::format("{}", s.slabs), fmt::format("{}", s.blocks),
+                           fmt::format("{}", s.in_use), fmt::format("{}", s.peak), fmt::format("{}", s.allocs)});
+        }
+        std::cout << table << std::endl;
+    }
+    return 0;
+}
+
+CMD_EXPORT(slab);
+
+// 配置容量为DYNAMIC_SIZE的消息和请求包的容量，只影响之后创建的对象，一般写在启动脚本中。
+int capacity(int argc, const char *argv[]) {
+    std::string name;
+    std::size_t cap = 0, max_cap = 0;
+    CLI::App app("capacity");
+    app.add_option("name", name, "the message or request to configure. show all configurations if not given.");
+    app.add_option("capacity", cap, "the capacity allocated at first.");
+    app.add_option("-m,--max", max_cap, "the max capacity it can grow to. fixed capacity if not larger than capacity.");
+    CLI11_PARSE(app, argc, argv);
+
+    if (name.empty()) {
+        tabulate::Table table;
+        table.add_row({"name", "capacity", "max capacity"})[0].format()
+                .font_align(tabulate::FontAlign::center)
+                .font_background_color(tabulate::Color::green);
+        std::unique_lock lock(capacity_map.mtx);
+        for (auto &[n, c]: capacity_map.map) {
+            table.add_row({n, fmt::format("{}", c.capacity), fmt::format("{}", std::max(c.capacity, c.max_capacity))});
+        }
+        std::cout << table << std::endl;
+        return 0;
+    }
+    if (cap == 0) {
+        std::cerr << "capacity must larger than 0." << std::endl;
+        return -1;
+    }
+    set_capacity(name, {cap, max_cap});
+    return 0;
+}
+
+CMD_EXPORT(capacity);
+
+// 查看或清空请求结果缓存
+int cache(int argc, const char *argv[]) {
+    std::string name = "*";
+    bool clear = false;
+    CLI::App app("cache");
+    app.add_option("request", name, "the request cache(s) to show, wildcard supported.");
+    app.add_flag("-c,--clear", clear, "clear the cached results.");
+    CLI11_PARSE(app, argc, argv);
+
+    tabulate::Table table;
+    table.add_row({"request", "size", "hit", "miss", "coalesced", "evicted", "hit rate"})[0].format()
+            .font_align(tabulate::FontAlign::center)
+            .font_background_color(tabulate::Color::green);
+    auto &m = obj_map[static_cast<int>(ObjType::CACHE)];
+    std::unique_lock lock(m.mtx);
+    for (auto &[n, v]: m.map) {
+        auto *c = dynamic_cast<CacheInfo *>(v.iface);
+        if (c == nullptr || !str_match(n.c_str(), name.c_str())) continue;
+        if (clear) c->clear();
+        auto s = c->get_stat();
+        auto total = s.hit + s.miss + s.coalesced;
+        table.add_row({n, fmt::format("{}", s.size), fmt::format("{}", s.hit), fmt::format("{}", s.miss),
+                       fmt::format("{}", s.coalesced), fmt::format("{}", s.evicted),
+                       total == 0 ? "-" : fmt::format("{:.1f}%", 100.0 * (s.hit + s.coalesced) / total)});
+    }
+    std::cout << table << std::endl;
+    return 0;
+}
+
+CMD_EXPORT(cache);
+
+// 查看或清空信封消息的端到端时延
+int latency(int argc, const char *argv[]) {
+    std::string name = "*";
+    bool clear = false;
+    CLI::App app("latency");
+    app.add_option("pipeline", name, "the pipeline(s) to show, wildcard supported, e.g. 'camera* -> *'.");
+    app.add_flag("-c,--clear", clear, "clear the recorded latency.");
+    CLI11_PARSE(app, argc, argv);
+
+    auto us = [](std::chrono::nanoseconds dt) { return fmt::format("{:.1f}us", dt.count() / 1e3); };
+    tabulate::Table table;
+    table.add_row({"pipeline", "count", "mean", "p50", "p90", "p99", "max"})[0].format()
+            .font_align(tabulate::FontAlign::center)
+            .font_background_color(tabulate::Color::green);
+    std::unique_lock lock(latency_map.mtx);
+    for (auto &[n, h]: latency_map.map) {
+        if (!str_match(n.c_str(), name.c_str())) continue;
+        if (clear) h.clear();
+        table.add_row({n, fmt::format("{}", h.get_count()), us(h.get_mean()), us(h.get_percentile(0.5)),
+                       us(h.get_percentile(0.9)), us(h.get_percentile(0.99)), us(h.get_max())});
+    }
+    std::cout << table << std::endl;
+    return 0;
+}
+
+CMD_EXPORT(latency);
+
+// 查看或修改参数集
+int param(int argc, const char *argv[]) {
+    std::string name = "*", field, value;
+    CLI::App app("param");
+    app.add_option("param", name, "the parameter set(s) to show, wildcard supported.");
+    auto set = app.add_subcommand("set", "set a field and publish a new version of the parameter set.");
+    set->add_option("param", name, "the parameter set to modify.")->required();
+    set->add_option("field", field, "the field to modify.")->required();
+    set->add_option("value", value, "the new value of the field.")->required();
+    CLI11_PARSE(app, argc, argv);
+
+    auto &m = obj_map[static_cast<int>(ObjType::PARAM)];
+    std::unique_lock lock(m.mtx);
+    if (set->parsed()) {
+        auto it = m.map.find(name);
+        auto *p = it == m.map.end() ? nullptr : dynamic_cast<ParamInfo *>(it->second.iface);
+        if (p == nullptr) {
+            std::cerr << "no such parameter set: " << name << std::endl;
+            return -1;
+        }
+        if (!p->set_field(field, value)) {
+            std::cerr << "can not set '" << field << "' to '" << value << "'." << std::endl;
+            return -1;
+        }
+        std::cout << name << "." << field << " = " << value << ", version "
+                  << p->get_version() << std::endl;
+        return 0;
+    }
+    tabulate::Table table;
+    table.add_row({"param", "version", "field", "value"})[0].format()
+            .font_align(tabulate::FontAlign::center)
+            .font_background_color(tabulate::Color::green);
+    for (auto &[n, v]: m.map) {
+        auto *p = dynamic_cast<ParamInfo *>(v.iface);
+        if (p == nullptr || !str_match(n.c_str(), name.c_str())) continue;
+        auto version = fmt::format("{}", p->get_version());
+        for (auto &[f, s]: p->get_fields()) table.add_row({n, version, f, s});
+    }
+    std::cout << table << std::endl;
+    return 0;
+}
+
+CMD_EXPORT(param);
+
 // 将输入流重定向到终端
 int console(int argc, const char *argv[]) {
 #ifdef __linux__
@@ -0,0 +1,327 @@
+//
+// Created by xinyang on 2020/9/12.
+//
+
+#include "register.h"
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <cstring>
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace tOS;
+using namespace tOS::service;
+
+/* 录制文件格式
+ * 文件头之后为连续的帧，每帧由帧头和数据组成，帧长度按8字节对齐。
+ * topic为TOPIC_DECLARE的帧为话题声明帧，数据为DeclareInfo+话题名+'\0'+类型名+'\0'。
+ * 文件末尾可能有未使用的全0空间（录制异常退出），回放时遇到全0帧头即结束。
+ */
+static constexpr char RECORD_MAGIC[8] = "tOSREC1";
+static constexpr std::uint32_t TOPIC_DECLARE = 0xffffffff;
+
+struct RecordHeader {
+    char magic[8];
+    std::uint64_t capacity;
+};
+
+struct FrameHeader {
+    std::uint64_t stamp; // 录制时刻，单位ns
+    std::uint32_t topic;
+    std::uint32_t size;
+};
+
+struct DeclareInfo {
+    std::uint32_t id;
+    std::uint32_t name_len;
+};
+
+static constexpr std::uint64_t frame_length(std::uint64_t size) {
+    return (sizeof(FrameHeader) + size + 7) & ~static_cast<std::uint64_t>(7);
+}
+
+static std::uint64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* 录制器
+ * 文件预先分配并映射到内存，发布者线程直接把帧写入映射区域，
+ * 写入位置通过CAS预留，不需要额外的线程和系统调用。
+ */
+class Recorder {
+private:
+    struct TopicTap : public RawTap {
+        Recorder *recorder;
+        std::uint32_t id;
+        RawObj obj;
+
+        TopicTap(Recorder *r, std::uint32_t i, RawObj &&o) : recorder(r), id(i), obj(std::move(o)) {}
+
+        void on_raw(const void *data, std::size_t size) override {
+            recorder->write(id, data, size);
+        }
+    };
+
+    int fd{-1};
+    unsigned char *base{nullptr};
+    std::uint64_t capacity{0};
+    std::atomic_uint64_t offset{sizeof(RecordHeader)};
+    std::atomic_size_t frames{0}, dropped{0};
+    std::vector<std::unique_ptr<TopicTap>> topics;
+
+    void write(std::uint32_t topic, const void *data, std::size_t size) {
+        auto len = frame_length(size);
+        // 在占用位置之前取时间戳，使文件中的时间戳尽量有序；并发写入时仍可能略微乱序。
+        auto stamp = steady_ns();
+        auto pos = offset.load(std::memory_order_relaxed);
+        do {
+            if (pos + len > capacity) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        } while (!offset.compare_exchange_weak(pos, pos + len, std::memory_order_relaxed));
+        FrameHeader header{stamp, topic, static_cast<std::uint32_t>(size)};
+        std::memcpy(base + pos, &header, sizeof(header));
+        std::memcpy(base + pos + sizeof(header), data, size);
+        frames.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void declare(std::uint32_t id, const std::string &name, const char *type) {
+        std::vector<char> buf(sizeof(DeclareInfo));
+        DeclareInfo info{id, static_cast<std::uint32_t>(name.size())};
+        std::memcpy(buf.data(), &info, sizeof(info));
+        buf.insert(buf.end(), name.c_str(), name.c_str() + name.size() + 1);
+        buf.insert(buf.end(), type, type + std::strlen(type) + 1);
+        write(TOPIC_DECLARE, buf.data(), buf.size());
+    }
+
+public:
+    ~Recorder() { stop(); }
+
+    bool open(const std::string &file, std::uint64_t cap) {
+        fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            std::cerr << "can not open record file '" << file << "'." << std::endl;
+            return false;
+        }
+        if (posix_fallocate(fd, 0, cap) != 0) {
+            std::cerr << "can not allocate " << cap << " bytes for '" << file << "'." << std::endl;
+            return false;
+        }
+        void *p = mmap(nullptr, cap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            std::cerr << "can not map record file '" << file << "'." << std::endl;
+            return false;
+        }
+        base = static_cast<unsigned char *>(p);
+        capacity = cap;
+        RecordHeader header{};
+        std::memcpy(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+        header.capacity = cap;
+        std::memcpy(base, &header, sizeof(header));
+        return true;
+    }
+
+    // 挂载所有匹配的话题，返回成功挂载的话题个数。
+    std::size_t attach(const std::string &pattern) {
+        std::vector<std::string> names;
+        {
+            auto &m = obj_map[static_cast<int>(ObjType::MESSAGE)];
+            std::unique_lock lock(m.mtx);
+            for (auto &[n, v]: m.map) {
+                if (dynamic_cast<RawMessage *>(v.iface) != nullptr && str_match(n.c_str(), pattern.c_str())) names.push_back(n);
+            }
+        }
+        for (auto &n: names) {
+            auto obj = RawObj::find(ObjType::MESSAGE, n);
+            if (!obj) continue;
+            if (!obj->raw_recordable()) {
+                std::cerr << "topic '" << n << "' can not be recorded and replayed, skip." << std::endl;
+                continue;
+            }
+            auto id = static_cast<std::uint32_t>(topics.size());
+            declare(id, n, obj->raw_type());
+            auto &t = topics.emplace_back(std::make_unique<TopicTap>(this, id, std::move(obj)));
+            t->obj->attach_tap(t.get());
+        }
+        return topics.size();
+    }
+
+    void stop() {
+        // 先卸载监听器，卸载需要获取消息锁，保证不再有写入。
+        for (auto &t: topics) t->obj->detach_tap(t.get());
+        topics.clear();
+        if (base != nullptr) {
+            munmap(base, capacity);
+            base = nullptr;
+        }
+        if (fd >= 0) {
+            if (ftruncate(fd, offset.load()) != 0) {
+                std::cerr << "truncate record file fail." << std::endl;
+            }
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    std::size_t get_frames() const { return frames.load(); }
+
+    std::size_t get_dropped() const { return dropped.load(); }
+
+    std::uint64_t get_bytes() const { return offset.load(); }
+};
+
+// 当前正在进行的录制，以文件名为键。只在shell线程中访问。
+static std::unordered_map<std::string, std::unique_ptr<Recorder>> recorders;
+
+int record(int argc, const char *argv[]) {
+    std::string topic, file;
+    std::uint64_t size_mb = 256;
+    bool stop = false;
+    CLI::App app("record");
+    app.add_option("topic", topic, "the topic(s) to record, wildcard supported.");
+    app.add_option("file", file, "the record file.");
+    app.add_option("-s,--size", size_mb, "the preallocated file size in MB.");
+    app.add_flag("--stop", stop, "stop recording to the file.\n"
+                                 "usage: record --stop <file>");
+    CLI11_PARSE(app, argc, argv);
+
+    if (stop) {
+        if (file.empty()) file = topic;
+        auto iter = recorders.find(file);
+        if (iter == recorders.end()) {
+            std::cerr << "no recording to '" << file << "'." << std::endl;
+            return -1;
+        }
+        auto &r = iter->second;
+        r->stop();
+        std::cout << file << ": " << r->get_frames() << " frames, " << r->get_bytes() << " bytes, "
+                  << r->get_dropped() << " dropped." << std::endl;
+        recorders.erase(iter);
+        return 0;
+    }
+
+    if (topic.empty() || file.empty()) {
+        std::cerr << "usage: record <topic> <file> [-s size]" << std::endl;
+        return -1;
+    }
+    if (recorders.count(file) != 0) {
+        std::cerr << "already recording to '" << file << "'." << std::endl;
+        return -1;
+    }
+    auto r = std::make_unique<Recorder>();
+    if (!r->open(file, size_mb << 20)) return -1;
+    if (r->attach(topic) == 0) {
+        std::cerr << "no recordable topic matches '" << topic << "'." << std::endl;
+        r->stop();
+        return -1;
+    }
+    recorders.emplace(file, std::move(r));
+    return 0;
+}
+
+CMD_EXPORT(record);
+
+// 按录制时的时间间隔回放，rate<=0时尽快回放。
+static void play_file(const std::string &file, double rate) {
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "can not open record file '" << file << "'." << std::endl;
+        return;
+    }
+    struct stat st{};
+    fstat(fd, &st);
+    auto length = static_cast<std::uint64_t>(st.st_size);
+    if (length < sizeof(RecordHeader)) {
+        std::cerr << "'" << file << "' is not a record file." << std::endl;
+        ::close(fd);
+        return;
+    }
+    void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "can not map record file '" << file << "'." << std::endl;
+        return;
+    }
+    madvise(p, length, MADV_SEQUENTIAL);
+    auto *base = static_cast<const unsigned char *>(p);
+    if (std::memcmp(base, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0) {
+        std::cerr << "'" << file << "' is not a record file." << std::endl;
+        munmap(p, length);
+        return;
+    }
+
+    std::vector<RawObj> topics;
+    std::uint64_t first_stamp = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::size_t cnt = 0;
+    for (std::uint64_t pos = sizeof(RecordHeader); pos + sizeof(FrameHeader) <= length;) {
+        FrameHeader header{};
+        std::memcpy(&header, base + pos, sizeof(header));
+        if (header.stamp == 0 && header.size == 0) break; // 未使用的空间
+        if (pos + frame_length(header.size) > length) break;
+        const auto *data = base + pos + sizeof(FrameHeader);
+        pos += frame_length(header.size);
+
+        if (header.topic == TOPIC_DECLARE) {
+            // 截断或损坏的声明帧：名字或类型越出帧的范围，跳过。
+            if (header.size < sizeof(DeclareInfo)) continue;
+            DeclareInfo info{};
+            std::memcpy(&info, data, sizeof(info));
+            if (header.size < sizeof(info) + static_cast<std::uint64_t>(info.name_len) + 2) continue;
+            const char *type = reinterpret_cast<const char *>(data + sizeof(info) + info.name_len + 1);
+            auto type_len = header.size - sizeof(info) - info.name_len - 1;
+            if (std::memchr(type, '\0', type_len) == nullptr) continue;
+            std::string name(reinterpret_cast<const char *>(data + sizeof(info)), info.name_len);
+            if (topics.size() <= info.id) topics.resize(info.id + 1);
+            auto obj = RawObj::find(ObjType::MESSAGE, name);
+            if (!obj) {
+                std::cerr << "topic '" << name << "' not found, skip." << std::endl;
+            } else if (std::strcmp(obj->raw_type(), type) != 0) {
+                std::cerr << "topic '" << name << "' type mismatch, skip." << std::endl;
+            } else {
+                obj->raw_attach_publisher();
+                topics[info.id] = std::move(obj);
+            }
+            continue;
+        }
+        if (header.topic >= topics.size() || !topics[header.topic]) continue;
+        if (first_stamp == 0) first_stamp = header.stamp;
+        if (rate > 0) {
+            // 并发录制的帧可能早于第一帧，按有符号数计算并截断为0。
+            auto ns = static_cast<std::int64_t>(header.stamp) - static_cast<std::int64_t>(first_stamp);
+            auto dt = std::chrono::nanoseconds(static_cast<std::int64_t>(std::max<std::int64_t>(ns, 0) / rate));
+            std::this_thread::sleep_until(start + dt);
+        }
+        topics[header.topic]->raw_push(data, header.size);
+        cnt++;
+    }
+    for (auto &t: topics) if (t) t->raw_detach_publisher();
+    munmap(p, length);
+    std::cout << file << ": " << cnt << " frames played." << std::endl;
+}
+
+int play(int argc, const char *argv[]) {
+    std::string file;
+    double rate = 1.0;
+    CLI::App app("play");
+    app.add_option("file", file, "the record file to play.")->required();
+    app.add_option("-r,--rate", rate, "the play rate. set to 0 to play as fast as possible.");
+    CLI11_PARSE(app, argc, argv);
+
+    std::thread(play_file, file, rate).detach();
+    return 0;
+}
+
+CMD_EXPORT(play);
+
+#endif
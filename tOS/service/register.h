@@ -33,6 +33,27 @@ namespace tOS::service {
         template<class Func_t>
         PreMainExec(Func_t func) { func(); }
     };
+
+    // 通配符匹配
+    inline bool str_match(const char *str, const char *pattern) {
+        while (*pattern != 0) {
+            if (*str == 0) return false; // 无字符可匹配，匹配失败
+            switch (*pattern) {
+                case '?': // ?匹配单个任意字符
+                    str++, pattern++;
+                    break;
+                case '*': // *匹配任意个任意字符
+                    while (*pattern == '*') pattern++; // 合并多个*
+                    if (*pattern == 0) return true; // *后没有字符，必定匹配成功
+                    while (*str != 0 && *str != *pattern) str++;
+                    break;
+                default: // 匹配当前字符
+                    if (*str++ != *pattern++) return false;
+            }
+        }
+        // 通配符结束，被匹配字符也应该结束，否则匹配失败
+        return *str == 0;
+    }
 }
 
 #define CMD_EXPORT(func)                __attribute__((unused)) tOS::service::Register \
@@ -7,18 +7,33 @@
 
 #include "tOS_config.h"
 
+#include "core/ObjInfo.h"
 #include "core/ObjManager.h"
 #include "core/Node.h"
 #include "core/Logger.h"
 #include "core/Message.h"
 #include "core/Request.h"
 #include "core/Container.h"
+#include "core/Serialize.h"
 #include "core/Sync.h"
+#include "core/RawMessage.h"
+#include "core/Scheduler.h"
+#include "core/AQM.h"
+#include "core/Stream.h"
+#include "core/Cache.h"
+#include "core/TimeSync.h"
+#include "core/Envelope.h"
+#include "core/Flow.h"
+#include "core/Param.h"
 
 #include "utils/BitMap.h"
 #include "utils/ObjectPool.h"
+#include "utils/SlabResource.h"
 #include "utils/CircularQueue.h"
 #include "utils/Stack.h"
+#include "utils/PriorityQueue.h"
+#include "utils/ConflatingQueue.h"
+#include "utils/RawStorage.h"
 
 #include "service/register.h"
 
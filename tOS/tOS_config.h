@@ -14,4 +14,28 @@
 // set to 1 to lock for the log.
 #define TOS_LOG_LOCK_DEFAULT        (1)
 
+// the default capacity of messages and requests whose SIZE is DYNAMIC_SIZE.
+#define TOS_DYNAMIC_SIZE_DEFAULT    (16)
+
+// the default number of buffered items in a stream, i.e. the flow control window.
+#define TOS_STREAM_WINDOW_DEFAULT   (16)
+
+// the number of buffered messages per topic in TimeSynchronizer.
+#define TOS_TIME_SYNC_DEPTH         (32)
+
+// the cache line size, used to separate data written by different threads.
+#define TOS_CACHE_LINE_SIZE         (64)
+
+// the max threads that read RCU protected parameters, each reader thread occupies one slot.
+#define TOS_RCU_MAX_READERS         (64)
+
+// the max objects cached per thread in ObjectPool. set to 0 to disable the cache.
+#define TOS_POOL_MAGAZINE_SIZE      (16)
+
+// the max block size served by SlabResource size classes, must be a power of 2.
+#define TOS_SLAB_MAX_BLOCK          (65536)
+
+// the bytes requested from upstream for each slab of SlabResource.
+#define TOS_SLAB_SIZE               (65536)
+
 #endif /* TOS_TOS_CONFIG_H */
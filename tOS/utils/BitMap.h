@@ -9,6 +9,10 @@
 #include <cstdint>
 #include <type_traits>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 namespace tOS {
     /***** bitmap大小类型定义 *****/
     using BITMAP_SIZE_8 = std::uint8_t;
@@ -48,8 +52,12 @@ namespace tOS {
             return bit;
         }
 
-        // 取最低位1的bit位置，折半查找，4bit内查表。
+        // 取最低位1的bit位置，有编译器内建函数时使用bsf/tzcnt指令，否则折半查找，4bit内查表。
         inline std::size_t lowbit() const {
+#if defined(__GNUC__)
+            if (bit == 0) return -1;
+            return __builtin_ctzll(bit);
+#else
             static std::size_t lowbit_map[] = {
                     -1u, 0, 1, 0, 2, 0, 1, 0,
                     3, 0, 1, 0, 2, 0, 1, 0,
@@ -74,14 +82,134 @@ namespace tOS {
                 else { v >>= 4, n += 4; }
             }
             return n + lowbit_map[v];
+#endif
         }
 
-        // 计算为1的bit的个数，分组归并算法。
+        // 计算为1的bit的个数，支持popcnt指令时直接使用，否则使用分组归并算法。
         inline std::size_t bitcnt() const {
+#if defined(__GNUC__) && defined(__POPCNT__)
+            return __builtin_popcountll(bit);
+#else
             std::size_t n = bit - ((bit >> 1) & (BITMAP_SIZE_T) 0x5555555555555555);
             n = (n & (BITMAP_SIZE_T) 0x3333333333333333) + ((n >> 2) & (BITMAP_SIZE_T) 0x3333333333333333);
-            return (((n + (n >> 4)) & (BITMAP_SIZE_T) 0x0F0F0F0F0F0F0F0F) * (BITMAP_SIZE_T) 0x0101010101010101)
+            return static_cast<BITMAP_SIZE_T>(((n + (n >> 4)) & (BITMAP_SIZE_T) 0x0F0F0F0F0F0F0F0F)
+                                              * (BITMAP_SIZE_T) 0x0101010101010101)
                     >> (sizeof(BITMAP_SIZE_T) * 8 - 8);
+#endif
+        }
+    };
+
+    /* 任意位数的bitmap
+     * 以64bit字数组存储，查找和计数逐字使用BitMap<BITMAP_SIZE_64>，
+     * 开启AVX2时按256bit批量进行与、或、与非运算。
+     * 适用于上千位的就绪集合、槽位分配表等。
+     * N: bit位数
+     */
+    template<std::size_t N>
+    class BigBitMap {
+    private:
+        static_assert(N > 0);
+        using Word = BitMap<BITMAP_SIZE_64>;
+        static constexpr std::size_t WORDS = (N + 63) / 64;
+
+        alignas(32) BITMAP_SIZE_64 words[WORDS]{};
+
+        // 对每个字执行op，AVX2下每次处理4个字。
+        template<class Op, class VecOp>
+        inline void bulk(const BigBitMap &o, Op op, VecOp vop) {
+            std::size_t i = 0;
+#if defined(__AVX2__)
+            for (; i + 4 <= WORDS; i += 4) {
+                auto a = _mm256_load_si256(reinterpret_cast<const __m256i *>(words + i));
+                auto b = _mm256_load_si256(reinterpret_cast<const __m256i *>(o.words + i));
+                _mm256_store_si256(reinterpret_cast<__m256i *>(words + i), vop(a, b));
+            }
+#endif
+            for (; i < WORDS; i++) words[i] = op(words[i], o.words[i]);
+        }
+
+    public:
+        constexpr static std::size_t size = N;
+
+        BigBitMap() = default;
+
+        inline bool get_bit(std::size_t i) const {
+            return (words[i / 64] >> (i % 64)) & 1;
+        }
+
+        inline void set_bit(std::size_t i) {
+            words[i / 64] |= static_cast<BITMAP_SIZE_64>(1) << (i % 64);
+        }
+
+        inline void clear_bit(std::size_t i) {
+            words[i / 64] &= ~(static_cast<BITMAP_SIZE_64>(1) << (i % 64));
+        }
+
+        inline void clear() {
+            for (auto &w: words) w = 0;
+        }
+
+        inline bool any() const {
+            for (auto w: words) if (w != 0) return true;
+            return false;
+        }
+
+        inline bool none() const { return !any(); }
+
+        // 取最低位1的bit位置，不存在时返回-1。
+        inline std::size_t lowbit() const {
+            for (std::size_t i = 0; i < WORDS; i++) {
+                if (words[i] != 0) return i * 64 + Word(words[i]).lowbit();
+            }
+            return -1;
+        }
+
+        // 取位置i之后（不含i）的第一个1的bit位置，不存在时返回-1。
+        inline std::size_t next_bit(std::size_t i) const {
+            if (++i >= N) return -1;
+            std::size_t w = i / 64;
+            BITMAP_SIZE_64 v = words[w] & (~static_cast<BITMAP_SIZE_64>(0) << (i % 64));
+            while (v == 0) {
+                if (++w == WORDS) return -1;
+                v = words[w];
+            }
+            return w * 64 + Word(v).lowbit();
+        }
+
+        // 计算为1的bit的个数。
+        inline std::size_t bitcnt() const {
+            std::size_t n = 0;
+            for (auto w: words) n += Word(w).bitcnt();
+            return n;
+        }
+
+        inline BigBitMap &operator|=(const BigBitMap &o) {
+#if defined(__AVX2__)
+            bulk(o, [](auto a, auto b) { return a | b; }, [](__m256i a, __m256i b) { return _mm256_or_si256(a, b); });
+#else
+            bulk(o, [](auto a, auto b) { return a | b; }, nullptr);
+#endif
+            return *this;
+        }
+
+        inline BigBitMap &operator&=(const BigBitMap &o) {
+#if defined(__AVX2__)
+            bulk(o, [](auto a, auto b) { return a & b; }, [](__m256i a, __m256i b) { return _mm256_and_si256(a, b); });
+#else
+            bulk(o, [](auto a, auto b) { return a & b; }, nullptr);
+#endif
+            return *this;
+        }
+
+        // 清除o中为1的位，即*this &= ~o。
+        inline BigBitMap &andnot(const BigBitMap &o) {
+#if defined(__AVX2__)
+            bulk(o, [](auto a, auto b) { return a & ~b; },
+                 [](__m256i a, __m256i b) { return _mm256_andnot_si256(b, a); });
+#else
+            bulk(o, [](auto a, auto b) { return a & ~b; }, nullptr);
+#endif
+            return *this;
         }
     };
 }
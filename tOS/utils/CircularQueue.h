@@ -6,6 +6,7 @@
 #define TOS_CIRCULARQUEUE_H
 
 #include "../tOS_config.h"
+#include "RawStorage.h"
 #include <stdexcept>
 
 namespace tOS {
@@ -56,20 +57,29 @@ namespace tOS {
 
 
     /* 无锁循环队列
+     * 元素存放在未初始化的存储中，入队时原地构造，出队时析构。
      * T: 循环队列元素类型
-     * size：循环队列容量
+     * size：循环队列容量，为DYNAMIC_SIZE时在运行时确定
      * CHECK：是否开启运行时错误检查。
      */
     template<class T, std::size_t SIZE, bool CHECK = TOS_CHECK_DEFAULT>
     class CircularQueue {
-    public:
-        T buffer[SIZE];
+    private:
+        RawStorage<T, SIZE> buffer;
         QueuePos<SIZE> head, tail;
     public:
         using ValType = T;
 
         CircularQueue() = default;
 
+        ~CircularQueue() {
+            while (!empty()) buffer.destroy(static_cast<std::size_t>(head++));
+        }
+
+        CircularQueue(const CircularQueue &) = delete;
+
+        CircularQueue &operator=(const CircularQueue &) = delete;
+
         inline std::size_t size() const { return tail - head; }
 
         inline bool empty() const { return tail - head == 0; }
@@ -78,23 +88,113 @@ namespace tOS {
 
         inline void push(const T &obj) {
             if constexpr (CHECK) if (full()) throw std::range_error("queue full!");
-            buffer[static_cast<std::size_t>(tail++)] = obj;
+            buffer.construct(static_cast<std::size_t>(tail), obj);
+            ++tail;
         }
 
         inline void push(T &&obj) {
             if constexpr (CHECK) if (full()) throw std::range_error("queue full!");
-            buffer[static_cast<std::size_t>(tail++)] = std::move(obj);
+            buffer.construct(static_cast<std::size_t>(tail), std::move(obj));
+            ++tail;
         }
 
         template<class ...Ts>
         inline void emplace(Ts &&... args) {
             if constexpr (CHECK) if (full()) throw std::range_error("queue full!");
-            buffer[static_cast<std::size_t>(tail++)] = T{std::forward<Ts>(args)...};
+            buffer.construct(static_cast<std::size_t>(tail), std::forward<Ts>(args)...);
+            ++tail;
+        }
+
+        // 队列中的第i个元素，0为队首。
+        inline T &operator[](std::size_t i) {
+            i += static_cast<std::size_t>(head);
+            return buffer[i >= SIZE ? i - SIZE : i];
+        }
+
+        inline const T &operator[](std::size_t i) const {
+            i += static_cast<std::size_t>(head);
+            return buffer[i >= SIZE ? i - SIZE : i];
+        }
+
+        inline T pop() {
+            if constexpr (CHECK) if (empty()) throw std::range_error("queue empty!");
+            auto i = static_cast<std::size_t>(head++);
+            T obj = std::move(buffer[i]);
+            buffer.destroy(i);
+            return obj;
+        }
+    };
+
+    /* 运行时确定容量的循环队列
+     * 首次入队时才分配内存，队列满且未达到最大容量时倍增扩容。
+     * 扩容会移动全部元素，因此只能在锁内使用。
+     */
+    template<class T, bool CHECK>
+    class CircularQueue<T, DYNAMIC_SIZE, CHECK> {
+    private:
+        RawStorage<T, DYNAMIC_SIZE> buffer;
+        std::size_t head{0}, cnt{0};
+
+        inline std::size_t slot(std::size_t i) const {
+            i += head;
+            return i >= buffer.allocated() ? i - buffer.allocated() : i;
+        }
+
+        inline std::size_t prepare() {
+            if constexpr (CHECK) if (full()) throw std::range_error("queue full!");
+            if (buffer.reserve(cnt + 1, head, cnt)) head = 0;
+            return slot(cnt);
         }
 
+    public:
+        using ValType = T;
+
+        // capacity: 首次分配的容量，max_capacity: 最大容量
+        CircularQueue(std::size_t capacity, std::size_t max_capacity) : buffer(capacity, max_capacity) {}
+
+        ~CircularQueue() {
+            while (!empty()) pop();
+        }
+
+        CircularQueue(const CircularQueue &) = delete;
+
+        CircularQueue &operator=(const CircularQueue &) = delete;
+
+        inline std::size_t size() const { return cnt; }
+
+        inline bool empty() const { return cnt == 0; }
+
+        inline bool full() const { return cnt == buffer.capacity(); }
+
+        inline void push(const T &obj) {
+            buffer.construct(prepare(), obj);
+            ++cnt;
+        }
+
+        inline void push(T &&obj) {
+            buffer.construct(prepare(), std::move(obj));
+            ++cnt;
+        }
+
+        template<class ...Ts>
+        inline void emplace(Ts &&... args) {
+            buffer.construct(prepare(), std::forward<Ts>(args)...);
+            ++cnt;
+        }
+
+        // 队列中的第i个元素，0为队首。
+        inline T &operator[](std::size_t i) { return buffer[slot(i)]; }
+
+        inline const T &operator[](std::size_t i) const { return buffer[slot(i)]; }
+
         inline T pop() {
             if constexpr (CHECK) if (empty()) throw std::range_error("queue empty!");
-            return std::move(buffer[static_cast<std::size_t>(head++)]);
+            auto i = head;
+            T obj = std::move(buffer[i]);
+            buffer.destroy(i);
+            head = slot(1);
+            --cnt;
+            return obj;
         }
     };
 
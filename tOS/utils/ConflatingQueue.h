@@ -0,0 +1,104 @@
+//
+// Created by xinyang on 2020/10/6.
+//
+
+#ifndef TOS_CONFLATINGQUEUE_H
+#define TOS_CONFLATINGQUEUE_H
+
+#include "../tOS_config.h"
+#include "CircularQueue.h"
+#include <cstddef>
+#include <utility>
+
+namespace tOS {
+    // 合并队列默认的键提取器，取元素的成员key。可以为其他类型特化该模板以指定键。
+    template<class T>
+    struct ConflateKey {
+        const auto &operator()(const T &t) const { return t.key; }
+    };
+
+    /* 合并队列
+     * 先进先出，但同一个键最多只有一个元素在排队：入队时若已有相同键的元素，则原地替换该元素并保持其排队位置。
+     * 因此无论生产者如何突发，消费者每一轮对每个键至多处理一次，且总是得到该键最新的元素。
+     * 按键线性查找，不分配额外内存，适用于排队的键不多（数十个）的场景。
+     * T: 元素类型
+     * size: 队列容量，为DYNAMIC_SIZE时在运行时确定
+     * CHECK: 是否开启运行时错误检查
+     * KeyOf: 从元素中取出键，键需要可以用operator==比较
+     */
+    template<class T, std::size_t SIZE, bool CHECK = TOS_CHECK_DEFAULT, class KeyOf = ConflateKey<T>>
+    class ConflatingQueue {
+    private:
+        CircularQueue<T, SIZE, CHECK> q;
+        // 被原地替换的元素个数
+        std::size_t conflated{0};
+
+        // 与obj键相同的元素的下标，不存在时返回size()。
+        inline std::size_t find(const T &obj) const {
+            const auto &key = KeyOf()(obj);
+            std::size_t i = 0, n = q.size();
+            while (i < n && !(KeyOf()(q[i]) == key)) i++;
+            return i;
+        }
+
+    public:
+        using ValType = T;
+
+        ConflatingQueue() = default;
+
+        // 仅用于SIZE为DYNAMIC_SIZE的情况，参见RawStorage。
+        ConflatingQueue(std::size_t capacity, std::size_t max_capacity) : q(capacity, max_capacity) {}
+
+        ConflatingQueue(const ConflatingQueue &) = delete;
+
+        ConflatingQueue &operator=(const ConflatingQueue &) = delete;
+
+        inline std::size_t size() const { return q.size(); }
+
+        inline bool empty() const { return q.empty(); }
+
+        inline bool full() const { return q.full(); }
+
+        // 是否有与obj键相同的元素在排队，此时入队不占用新的位置。
+        inline bool contains(const T &obj) const { return find(obj) < q.size(); }
+
+        inline void push(const T &obj) {
+            auto i = find(obj);
+            if (i < q.size()) {
+                q[i] = obj;
+                conflated++;
+            } else {
+                q.push(obj);
+            }
+        }
+
+        inline void push(T &&obj) {
+            auto i = find(obj);
+            if (i < q.size()) {
+                q[i] = std::move(obj);
+                conflated++;
+            } else {
+                q.push(std::move(obj));
+            }
+        }
+
+        // 需要先构造出元素才能取得键。
+        template<class ...Ts>
+        inline void emplace(Ts &&... args) {
+            push(T{std::forward<Ts>(args)...});
+        }
+
+        inline T pop() { return q.pop(); }
+
+        inline std::size_t get_conflated_num() const { return conflated; }
+    };
+
+    // 用于判断一个类型是否为ConflatingQueue。
+    template<class T>
+    constexpr bool isConflatingQueue = false;
+
+    template<class T, std::size_t SIZE, bool CHECK, class KeyOf>
+    constexpr bool isConflatingQueue<ConflatingQueue<T, SIZE, CHECK, KeyOf>> = true;
+}
+
+#endif /* TOS_CONFLATINGQUEUE_H */
@@ -6,30 +6,272 @@
 #define TOS_OBJECTPOOL_H
 
 #include "../tOS_config.h"
-#include "CircularQueue.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
+#include <stdexcept>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace tOS {
-    /* 含锁对象池
+    /* 无锁对象池
+     * 空闲对象组成带标签的无锁链表（标签用于避免ABA问题），
+     * 每个线程对每个对象池另有一个小的对象缓存（magazine），常规的分配和释放只访问线程本地数据。
+     * 缓存大小为TOS_POOL_MAGAZINE_SIZE和SIZE/8中较小者，为0时不使用线程缓存。
+     * 空闲链表耗尽时先回收所有线程缓存中的对象，只有对象池真正耗尽时才分配失败。
      * T: 对象池元素类型
      * size: 对象池容量
      * CHECK: 是否开启运行时错误检查
+     * SHARED_CB: 是否为每个对象预留shared_ptr控制块的空间，使alloc_shared不需要额外分配内存
      */
-    template<class T, std::size_t SIZE, bool CHECK = TOS_CHECK_DEFAULT>
+    template<class T, std::size_t SIZE, bool CHECK = TOS_CHECK_DEFAULT, bool SHARED_CB = false>
     class ObjectPool {
     private:
-        static_assert(SIZE > 0);
-        T objs[SIZE];
-        // 使用循环队列存储未被分配的对象地址。
-        CircularQueue<T *, SIZE, false> available;
-        std::mutex mtx;
-    public:
-        ObjectPool() { // 初始化时把所有对象地址加入队列。
-            for (T *ptr = objs; ptr < objs + SIZE; ptr++) {
-                available.push(ptr);
+        static_assert(SIZE > 0 && SIZE < UINT32_MAX);
+        static constexpr std::uint32_t NIL = UINT32_MAX;
+        static constexpr std::size_t MAG_SIZE = std::min<std::size_t>(TOS_POOL_MAGAZINE_SIZE, SIZE / 8);
+        static constexpr std::size_t MAG_WAYS = 4;
+        // 每个对象附带的shared_ptr控制块空间
+        static constexpr std::size_t CB_SIZE = 96;
+
+        struct NoControlBlock {
+        };
+
+        struct ControlBlock {
+            alignas(std::max_align_t) unsigned char cb[CB_SIZE];
+        };
+
+        // 不使用alloc_shared的对象池不预留控制块的空间（空基类不占空间）。
+        struct Slot : std::conditional_t<SHARED_CB, ControlBlock, NoControlBlock> {
+            T obj;
+            std::atomic<std::uint32_t> next{NIL};
+        };
+
+        /* 线程本地对象缓存
+         * 所属线程访问时置active，回收缓存的线程先置steal，再等待active清除。
+         * 两边是非对称的Dekker同步：所属线程只用编译器屏障，回收的线程用membarrier让所有线程执行一次内存屏障，
+         * 因此常规的分配和释放没有原子读改写操作。不支持membarrier时两边都使用完整的内存屏障。
+         */
+        struct Magazine {
+            std::atomic_bool active{false};
+            std::atomic_bool steal{false};
+            std::size_t n{0};
+            std::uint32_t idx[MAG_SIZE > 0 ? MAG_SIZE : 1];
+
+            // 所属线程开始访问，正在被回收时等待回收结束。
+            void lock() {
+                while (true) {
+                    active.store(true, std::memory_order_relaxed);
+                    light_barrier();
+                    if (!steal.load(std::memory_order_acquire)) return;
+                    active.store(false, std::memory_order_release);
+                    while (steal.load(std::memory_order_acquire)) std::this_thread::yield();
+                }
+            }
+
+            void unlock() {
+                active.store(false, std::memory_order_release);
+            }
+        };
+
+        static bool asymmetric_barrier() {
+#if defined(__linux__) && defined(__NR_membarrier)
+            static const bool ok = syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+            return ok;
+#else
+            return false;
+#endif
+        }
+
+        static void light_barrier() {
+            if (asymmetric_barrier()) std::atomic_signal_fence(std::memory_order_seq_cst);
+            else std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        static void heavy_barrier() {
+#if defined(__linux__) && defined(__NR_membarrier)
+            if (asymmetric_barrier()) {
+                syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+                return;
+            }
+#endif
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        // 一个线程在各对象池中的缓存，以对象池的标识为键。
+        // hot按标识直接映射，加速查找；冲突时只是退回到哈希表查找，不会归还缓存。
+        struct MagazineSet {
+            std::pair<std::uint64_t, Magazine *> hot[MAG_WAYS]{};
+            std::unordered_map<std::uint64_t, std::unique_ptr<Magazine>> m;
+
+            // 线程退出时把缓存的对象还给仍然存在的对象池。
+            ~MagazineSet() {
+                std::unique_lock lock(registry_mtx);
+                for (auto &[i, mag]: m) {
+                    auto iter = registry.find(i);
+                    if (iter != registry.end()) iter->second->release(mag.get());
+                }
+            }
+        };
+
+        // 存活的对象池，用于线程退出或缓存被替换时判断对象池是否已经析构。
+        static inline std::mutex registry_mtx;
+        static inline std::unordered_map<std::uint64_t, ObjectPool *> registry;
+        static inline std::atomic_uint64_t next_id{1};
+
+        Slot slots[SIZE];
+        // 空闲链表头，高32位为标签，低32位为对象下标。
+        alignas(64) std::atomic<std::uint64_t> head;
+        const std::uint64_t id{next_id++};
+        // 各线程中属于该对象池的缓存，用于空闲链表耗尽时回收对象。
+        std::mutex mags_mtx;
+        std::vector<Magazine *> mags;
+
+        static std::uint64_t pack(std::uint64_t tag, std::uint32_t idx) { return (tag << 32) | idx; }
+
+        static std::uint32_t index(std::uint64_t h) { return static_cast<std::uint32_t>(h); }
+
+        // 把first到last的链（已经通过next连接）放回空闲链表。
+        void push_chain(std::uint32_t first, std::uint32_t last) {
+            auto h = head.load(std::memory_order_relaxed);
+            do {
+                slots[last].next.store(index(h), std::memory_order_relaxed);
+            } while (!head.compare_exchange_weak(h, pack((h >> 32) + 1, first),
+                                                 std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        // 从空闲链表取出至多n个对象，返回取出的个数。
+        // 标签每次修改都会递增，CAS成功说明链表未被修改过，遍历到的链是有效的。
+        std::size_t pop_chain(std::uint32_t *out, std::size_t n) {
+            auto h = head.load(std::memory_order_acquire);
+            std::size_t k;
+            std::uint32_t i;
+            do {
+                k = 0;
+                i = index(h);
+                while (k < n && i != NIL) {
+                    out[k++] = i;
+                    i = slots[i].next.load(std::memory_order_relaxed);
+                }
+                if (k == 0) return 0;
+            } while (!head.compare_exchange_weak(h, pack((h >> 32) + 1, i),
+                                                 std::memory_order_acquire, std::memory_order_acquire));
+            return k;
+        }
+
+        void push_batch(const std::uint32_t *idx, std::size_t n) {
+            if (n == 0) return;
+            for (std::size_t k = 0; k + 1 < n; k++) {
+                slots[idx[k]].next.store(idx[k + 1], std::memory_order_relaxed);
             }
+            push_chain(idx[0], idx[n - 1]);
+        }
+
+        // 线程退出时归还缓存并注销，需持有registry_mtx。
+        void release(Magazine *mag) {
+            std::unique_lock lock(mags_mtx);
+            mags.erase(std::find(mags.begin(), mags.end(), mag));
+            push_batch(mag->idx, mag->n);
+        }
+
+        // 空闲链表耗尽时，把所有线程缓存中的对象归还到空闲链表。
+        void reclaim() {
+            std::unique_lock lock(mags_mtx);
+            for (auto *mag: mags) mag->steal.store(true, std::memory_order_relaxed);
+            heavy_barrier();
+            for (auto *mag: mags) {
+                while (mag->active.load(std::memory_order_acquire)) std::this_thread::yield();
+                push_batch(mag->idx, mag->n);
+                mag->n = 0;
+                mag->steal.store(false, std::memory_order_release);
+            }
+        }
+
+        Magazine &magazine() {
+            static thread_local MagazineSet set;
+            auto &h = set.hot[id % MAG_WAYS];
+            if (h.first == id) return *h.second;
+            auto &mag = set.m[id];
+            if (!mag) { // 第一次在该线程中使用该对象池，创建缓存并注册。
+                mag = std::make_unique<Magazine>();
+                std::unique_lock lock(registry_mtx);
+                // 顺便丢弃已经析构的对象池的缓存。
+                for (auto iter = set.m.begin(); iter != set.m.end();) {
+                    if (registry.count(iter->first) != 0) {
+                        ++iter;
+                        continue;
+                    }
+                    auto &stale = set.hot[iter->first % MAG_WAYS];
+                    if (stale.first == iter->first) stale = {0, nullptr};
+                    iter = set.m.erase(iter);
+                }
+                std::unique_lock mags_lock(mags_mtx);
+                mags.push_back(mag.get());
+            }
+            h = {id, mag.get()};
+            return *mag;
+        }
+
+        std::uint32_t slot_index(const T *ptr) const {
+            return static_cast<std::uint32_t>(
+                    (reinterpret_cast<std::uintptr_t>(ptr) - reinterpret_cast<std::uintptr_t>(&slots[0].obj))
+                    / sizeof(Slot));
+        }
+
+        // 把shared_ptr的控制块放在对象自带的空间里，控制块释放时才归还对象。
+        template<class U>
+        struct SlotAllocator {
+            using value_type = U;
+            ObjectPool *pool;
+            std::uint32_t i;
+
+            SlotAllocator(ObjectPool *p, std::uint32_t idx) : pool(p), i(idx) {}
+
+            template<class V>
+            SlotAllocator(const SlotAllocator<V> &o) : pool(o.pool), i(o.i) {}
+
+            U *allocate(std::size_t n) {
+                if (n * sizeof(U) > CB_SIZE || alignof(U) > alignof(std::max_align_t)) {
+                    return static_cast<U *>(::operator new(n * sizeof(U)));
+                }
+                return reinterpret_cast<U *>(pool->slots[i].cb);
+            }
+
+            void deallocate(U *p, std::size_t) {
+                if (reinterpret_cast<unsigned char *>(p) != pool->slots[i].cb) ::operator delete(p);
+                pool->free(&pool->slots[i].obj);
+            }
+
+            template<class V>
+            bool operator==(const SlotAllocator<V> &o) const { return pool == o.pool && i == o.i; }
+
+            template<class V>
+            bool operator!=(const SlotAllocator<V> &o) const { return !(*this == o); }
+        };
+
+    public:
+        ObjectPool() { // 初始化时把所有对象链接成空闲链表。
+            for (std::uint32_t i = 0; i + 1 < SIZE; i++) slots[i].next.store(i + 1, std::memory_order_relaxed);
+            head.store(pack(0, 0));
+            std::unique_lock lock(registry_mtx);
+            registry.emplace(id, this);
+        }
+
+        ~ObjectPool() {
+            std::unique_lock lock(registry_mtx);
+            registry.erase(id);
         }
 
         // 不允许拷贝
@@ -39,25 +281,53 @@ namespace tOS {
 
         // 分配一个对象
         inline T *alloc() {
-            if (available.size() == 0) throw std::bad_alloc();
-            std::unique_lock lock(mtx);
-            return available.pop();
+            if constexpr (MAG_SIZE > 0) {
+                auto &mag = magazine();
+                std::lock_guard guard(mag);
+                if (mag.n == 0) mag.n = pop_chain(mag.idx, (MAG_SIZE + 1) / 2);
+                if (mag.n > 0) return &slots[mag.idx[--mag.n]].obj;
+            }
+            std::uint32_t i;
+            if (pop_chain(&i, 1) == 0) {
+                if constexpr (MAG_SIZE > 0) reclaim();
+                if (pop_chain(&i, 1) == 0) throw std::bad_alloc();
+            }
+            return &slots[i].obj;
         }
 
         // 释放一个对象
         inline void free(T *ptr) {
             if constexpr (CHECK) { // 检查参数的合法性。
-                if (ptr < objs || objs + SIZE <= ptr || ((uintptr_t) ptr - (uintptr_t) objs) % sizeof(T) != 0) {
+                auto p = reinterpret_cast<std::uintptr_t>(ptr), base = reinterpret_cast<std::uintptr_t>(&slots[0].obj);
+                if (p < base || (p - base) / sizeof(Slot) >= SIZE || (p - base) % sizeof(Slot) != 0) {
                     throw std::runtime_error("invalid free of ObjectPool!");
                 }
             }
-            std::unique_lock lock(mtx);
-            available.push(ptr);
+            auto i = slot_index(ptr);
+            if constexpr (MAG_SIZE > 0) {
+                auto &mag = magazine();
+                std::lock_guard guard(mag);
+                if (mag.n == MAG_SIZE) { // 缓存已满，归还一半到空闲链表。
+                    push_batch(mag.idx + MAG_SIZE / 2, MAG_SIZE - MAG_SIZE / 2);
+                    mag.n = MAG_SIZE / 2;
+                }
+                mag.idx[mag.n++] = i;
+            } else {
+                slots[i].next.store(NIL, std::memory_order_relaxed);
+                push_chain(i, i);
+            }
         }
 
         // 分配一个共享对象，必须保证该对象池的生命周期大于共享对象。
+        // SHARED_CB时控制块存放在对象自带的空间中，不需要额外分配内存。
         inline std::shared_ptr<T> alloc_shared() {
-            return std::shared_ptr<T>((std::remove_all_extents_t<T> *) alloc(), [this](void *ptr) { free((T *) ptr); });
+            auto *obj = alloc();
+            if constexpr (SHARED_CB) {
+                return std::shared_ptr<T>((std::remove_all_extents_t<T> *) obj, [](void *) {},
+                                          SlotAllocator<T>(this, slot_index(obj)));
+            } else {
+                return std::shared_ptr<T>((std::remove_all_extents_t<T> *) obj, [this](void *ptr) { free((T *) ptr); });
+            }
         }
     };
 }
@@ -0,0 +1,161 @@
+//
+// Created by xinyang on 2020/9/26.
+//
+
+#ifndef TOS_PRIORITYQUEUE_H
+#define TOS_PRIORITYQUEUE_H
+
+#include "../tOS_config.h"
+#include "RawStorage.h"
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace tOS {
+    /* 无锁优先队列，定长二叉堆实现，不进行堆内存分配。
+     * 元素存放在未初始化的存储中，入队时原地构造，出队时析构。
+     * 每个元素附带入队序号，优先级相同时先入队者先出，即出队顺序是稳定的。
+     * T: 优先队列元素类型
+     * size: 优先队列容量，为DYNAMIC_SIZE时在运行时确定
+     * CHECK: 是否开启运行时错误检查
+     * Compare: 比较函数，Compare(a, b)为true表示a的优先级低于b，与std::priority_queue一致
+     */
+    template<class T, std::size_t SIZE, bool CHECK = TOS_CHECK_DEFAULT, class Compare = std::less<T>>
+    class PriorityQueue {
+    private:
+        struct Item {
+            T obj;
+            // 入队序号，用于区分优先级相同的元素
+            std::uint64_t seq;
+
+            template<class ...Ts, std::enable_if_t<std::is_constructible_v<T, Ts &&...>, int> = 0>
+            explicit Item(std::uint64_t s, Ts &&...args) : obj(std::forward<Ts>(args)...), seq(s) {}
+
+            template<class ...Ts, std::enable_if_t<!std::is_constructible_v<T, Ts &&...>, int> = 0>
+            explicit Item(std::uint64_t s, Ts &&...args) : obj{std::forward<Ts>(args)...}, seq(s) {}
+        };
+
+        RawStorage<Item, SIZE> buffer;
+        std::size_t cnt;
+        std::uint64_t next_seq{0};
+        Compare cmp;
+
+        // a的优先级是否低于b：优先级相同时后入队者更低。
+        bool lower(const Item &a, const Item &b) const {
+            if (cmp(a.obj, b.obj)) return true;
+            if (cmp(b.obj, a.obj)) return false;
+            return a.seq > b.seq;
+        }
+
+        void sift_up(std::size_t i) {
+            while (i > 0) {
+                auto parent = (i - 1) / 2;
+                if (!lower(buffer[parent], buffer[i])) break;
+                std::swap(buffer[parent], buffer[i]);
+                i = parent;
+            }
+        }
+
+        void sift_down(std::size_t i) {
+            while (true) {
+                auto l = i * 2 + 1, r = l + 1, top = i;
+                if (l < cnt && lower(buffer[top], buffer[l])) top = l;
+                if (r < cnt && lower(buffer[top], buffer[r])) top = r;
+                if (top == i) break;
+                std::swap(buffer[top], buffer[i]);
+                i = top;
+            }
+        }
+
+    public:
+        using ValType = T;
+
+        PriorityQueue() : cnt(0) {};
+
+        // 仅用于SIZE为DYNAMIC_SIZE的情况，参见RawStorage。
+        PriorityQueue(std::size_t capacity, std::size_t max_capacity) : buffer(capacity, max_capacity), cnt(0) {};
+
+        ~PriorityQueue() {
+            while (cnt > 0) buffer.destroy(--cnt);
+        }
+
+        PriorityQueue(const PriorityQueue &) = delete;
+
+        PriorityQueue &operator=(const PriorityQueue &) = delete;
+
+        inline std::size_t size() const { return cnt; }
+
+        inline bool empty() const { return cnt == 0; }
+
+        inline bool full() const { return cnt == buffer.capacity(); }
+
+        inline void push(const T &obj) {
+            if constexpr(CHECK) if (full()) throw std::range_error("queue full!");
+            buffer.reserve(cnt + 1, 0, cnt);
+            buffer.construct(cnt, next_seq++, obj);
+            sift_up(cnt++);
+        }
+
+        inline void push(T &&obj) {
+            if constexpr(CHECK) if (full()) throw std::range_error("queue full!");
+            buffer.reserve(cnt + 1, 0, cnt);
+            buffer.construct(cnt, next_seq++, std::move(obj));
+            sift_up(cnt++);
+        }
+
+        template<class ...Ts>
+        inline void emplace(Ts &&... args) {
+            if constexpr(CHECK) if (full()) throw std::range_error("queue full!");
+            buffer.reserve(cnt + 1, 0, cnt);
+            buffer.construct(cnt, next_seq++, std::forward<Ts>(args)...);
+            sift_up(cnt++);
+        }
+
+        // 取出优先级最高的元素
+        inline T pop() {
+            if constexpr(CHECK) if (empty()) throw std::range_error("queue empty!");
+            T obj = std::move(buffer[0].obj);
+            if (--cnt > 0) {
+                buffer[0] = std::move(buffer[cnt]);
+                sift_down(0);
+            }
+            buffer.destroy(cnt);
+            return obj;
+        }
+
+        /* 容器满时为obj腾出空间：obj比优先级最低的元素更优先时丢弃该元素并返回true，
+         * 否则返回false，由调用者丢弃obj，避免低优先级的突发挤掉排队中的高优先级元素。最低者必在叶子节点中。
+         * obj尚未入队，优先级相同时视为低于已有元素。
+         */
+        inline bool evict(const T &obj) {
+            return evict(obj, [](T &&) {});
+        }
+
+        // 同evict(obj)，丢弃元素前将其交给on_evict。
+        template<class F>
+        inline bool evict(const T &obj, F &&on_evict) {
+            if constexpr(CHECK) if (empty()) throw std::range_error("queue empty!");
+            auto low = cnt / 2;
+            for (auto i = low + 1; i < cnt; i++) if (lower(buffer[i], buffer[low])) low = i;
+            if (!cmp(buffer[low].obj, obj)) return false;
+            on_evict(std::move(buffer[low].obj));
+            if (low != --cnt) {
+                buffer[low] = std::move(buffer[cnt]);
+                sift_up(low);
+            }
+            buffer.destroy(cnt);
+            return true;
+        }
+    };
+
+    // 用于判断一个类型是否为PriorityQueue。
+    template<class T>
+    constexpr bool isPriorityQueue = false;
+
+    template<class T, std::size_t SIZE, bool CHECK, class Compare>
+    constexpr bool isPriorityQueue<PriorityQueue<T, SIZE, CHECK, Compare>> = true;
+}
+
+#endif /* TOS_PRIORITYQUEUE_H */
@@ -0,0 +1,138 @@
+//
+// Created by xinyang on 2020/9/28.
+//
+
+#ifndef TOS_RAWSTORAGE_H
+#define TOS_RAWSTORAGE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace tOS {
+    // 容量为DYNAMIC_SIZE的容器在运行时确定容量。
+    constexpr std::size_t DYNAMIC_SIZE = 0;
+
+    /* 未初始化的定长存储
+     * 只分配对齐的内存，不构造元素。元素的构造和析构由使用者负责，
+     * 用于容器支持非默认构造的元素，并避免预先构造全部元素。
+     * T: 元素类型
+     * SIZE: 元素个数
+     */
+    template<class T, std::size_t SIZE>
+    class RawStorage {
+    private:
+        std::aligned_storage_t<sizeof(T), alignof(T)> buffer[SIZE];
+
+    public:
+        RawStorage() = default;
+
+        RawStorage(const RawStorage &) = delete;
+
+        RawStorage &operator=(const RawStorage &) = delete;
+
+        inline T &operator[](std::size_t i) {
+            return *std::launder(reinterpret_cast<T *>(&buffer[i]));
+        }
+
+        inline const T &operator[](std::size_t i) const {
+            return *std::launder(reinterpret_cast<const T *>(&buffer[i]));
+        }
+
+        // 在位置i原地构造元素，可以用圆括号构造时优先使用圆括号，否则使用列表初始化（如聚合体）。
+        template<class ...Ts>
+        inline T &construct(std::size_t i, Ts &&...args) {
+            if constexpr(std::is_constructible_v<T, Ts &&...>) {
+                return *new(&buffer[i]) T(std::forward<Ts>(args)...);
+            } else {
+                return *new(&buffer[i]) T{std::forward<Ts>(args)...};
+            }
+        }
+
+        inline void destroy(std::size_t i) {
+            (*this)[i].~T();
+        }
+
+        // 最多可存放的元素个数
+        static constexpr std::size_t capacity() { return SIZE; }
+
+        // 已分配的元素个数
+        static constexpr std::size_t allocated() { return SIZE; }
+
+        // 定长存储无需分配。
+        constexpr bool reserve(std::size_t n, std::size_t first, std::size_t count) { return false; }
+    };
+
+    /* 未初始化的变长存储
+     * 首次存放元素时才分配内存，之后按倍增扩容，直到最大容量。
+     * capacity: 首次分配的元素个数
+     * max_capacity: 最大元素个数，不大于capacity时容量固定为capacity
+     */
+    template<class T>
+    class RawStorage<T, DYNAMIC_SIZE> {
+    private:
+        using Slot = std::aligned_storage_t<sizeof(T), alignof(T)>;
+
+        std::unique_ptr<Slot[]> buffer;
+        std::size_t size{0};
+        std::size_t init_capacity, max_capacity;
+
+    public:
+        explicit RawStorage(std::size_t capacity, std::size_t max_capacity = 0) :
+                init_capacity(capacity), max_capacity(std::max(capacity, max_capacity)) {
+            if (capacity == 0) throw std::invalid_argument("capacity must larger than 0.");
+        }
+
+        RawStorage(const RawStorage &) = delete;
+
+        RawStorage &operator=(const RawStorage &) = delete;
+
+        inline T &operator[](std::size_t i) {
+            return *std::launder(reinterpret_cast<T *>(&buffer[i]));
+        }
+
+        inline const T &operator[](std::size_t i) const {
+            return *std::launder(reinterpret_cast<const T *>(&buffer[i]));
+        }
+
+        template<class ...Ts>
+        inline T &construct(std::size_t i, Ts &&...args) {
+            if constexpr(std::is_constructible_v<T, Ts &&...>) {
+                return *new(&buffer[i]) T(std::forward<Ts>(args)...);
+            } else {
+                return *new(&buffer[i]) T{std::forward<Ts>(args)...};
+            }
+        }
+
+        inline void destroy(std::size_t i) {
+            (*this)[i].~T();
+        }
+
+        inline std::size_t capacity() const { return max_capacity; }
+
+        inline std::size_t allocated() const { return size; }
+
+        /* 保证至少可以存放n个元素，返回是否重新分配了内存。
+         * 重新分配时，原存储中从first开始（首尾相接）的count个元素被依次移动到新存储的开头。
+         */
+        bool reserve(std::size_t n, std::size_t first, std::size_t count) {
+            if (n <= size) return false;
+            auto new_size = size == 0 ? init_capacity : size * 2;
+            new_size = std::min(std::max(new_size, n), max_capacity);
+            std::unique_ptr<Slot[]> new_buffer(new Slot[new_size]);
+            for (std::size_t i = 0, j = first; i < count; i++, j = j + 1 == size ? 0 : j + 1) {
+                new(&new_buffer[i]) T(std::move((*this)[j]));
+                destroy(j);
+            }
+            buffer = std::move(new_buffer);
+            size = new_size;
+            return true;
+        }
+    };
+}
+
+#endif /* TOS_RAWSTORAGE_H */
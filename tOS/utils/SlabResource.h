@@ -0,0 +1,158 @@
+//
+// Created by xinyang on 2020/9/20.
+//
+
+#ifndef TOS_SLABRESOURCE_H
+#define TOS_SLABRESOURCE_H
+
+#include "../tOS_config.h"
+#include <memory_resource>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace tOS {
+    // 一个大小类别的占用统计
+    struct SlabStat {
+        std::size_t block_size; // 块大小，0表示直接从上游分配的大块
+        std::size_t slabs;      // 从上游申请的slab个数
+        std::size_t blocks;     // 总块数
+        std::size_t in_use;     // 正在使用的块数
+        std::size_t peak;       // 历史最大使用块数
+        std::size_t allocs;     // 累计分配次数
+    };
+
+    // 计算[min_block, max_block]之间2的幂的个数。
+    constexpr std::size_t slab_class_num(std::size_t min_block, std::size_t max_block) {
+        std::size_t n = 0;
+        for (std::size_t s = min_block; s <= max_block; s <<= 1) n++;
+        return n;
+    }
+
+    /* 按大小分类的slab分配器
+     * 块大小为16字节到TOS_SLAB_MAX_BLOCK之间的2的幂，每个类别从上游按slab批量申请内存，
+     * 释放的块挂在类别的空闲链表上复用，不会归还上游，直到分配器析构。
+     * 超过最大块大小或对齐要求超过64字节的请求直接交给上游。
+     * 可以作为std::pmr容器的内存资源，例如std::pmr::vector<std::uint8_t> v(&slab);
+     */
+    class SlabResource : public std::pmr::memory_resource {
+    private:
+        static constexpr std::size_t MIN_BLOCK = 16;
+        static constexpr std::size_t SLAB_ALIGN = 64;
+
+        static constexpr std::size_t CLASS_NUM = slab_class_num(MIN_BLOCK, TOS_SLAB_MAX_BLOCK);
+
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+
+        struct alignas(64) SizeClass {
+            std::mutex mtx;
+            FreeBlock *free_list{nullptr};
+            std::vector<void *> slabs;
+            SlabStat stat{};
+        };
+
+        std::pmr::memory_resource *upstream;
+        SizeClass classes[CLASS_NUM];
+        std::mutex large_mtx;
+        SlabStat large{};
+
+        static std::size_t slab_bytes(std::size_t block) {
+            return block * 4 > TOS_SLAB_SIZE ? block * 4 : TOS_SLAB_SIZE;
+        }
+
+        // 计算满足大小和对齐的类别，不满足时返回类别个数。
+        static std::size_t class_of(std::size_t bytes, std::size_t alignment) {
+            if (alignment > SLAB_ALIGN) return CLASS_NUM;
+            std::size_t need = bytes > alignment ? bytes : alignment, i = 0;
+            for (std::size_t s = MIN_BLOCK; s < need; s <<= 1) i++;
+            return i;
+        }
+
+        void refill(SizeClass &c, std::size_t block) {
+            auto bytes = slab_bytes(block);
+            auto *slab = static_cast<unsigned char *>(upstream->allocate(bytes, SLAB_ALIGN));
+            c.slabs.push_back(slab);
+            for (std::size_t off = bytes; off >= block; off -= block) {
+                auto *b = reinterpret_cast<FreeBlock *>(slab + off - block);
+                b->next = c.free_list;
+                c.free_list = b;
+            }
+            c.stat.slabs++;
+            c.stat.blocks += bytes / block;
+        }
+
+    protected:
+        void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+            auto i = class_of(bytes, alignment);
+            if (i >= CLASS_NUM) {
+                // 先在锁外分配，分配失败时不计入统计，也不阻塞其他大块的分配。
+                auto *p = upstream->allocate(bytes, alignment);
+                std::unique_lock lock(large_mtx);
+                large.allocs++;
+                if (++large.in_use > large.peak) large.peak = large.in_use;
+                return p;
+            }
+            auto &c = classes[i];
+            std::unique_lock lock(c.mtx);
+            if (c.free_list == nullptr) refill(c, c.stat.block_size);
+            auto *b = c.free_list;
+            c.free_list = b->next;
+            c.stat.allocs++;
+            if (++c.stat.in_use > c.stat.peak) c.stat.peak = c.stat.in_use;
+            return b;
+        }
+
+        void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override {
+            auto i = class_of(bytes, alignment);
+            if (i >= CLASS_NUM) {
+                upstream->deallocate(p, bytes, alignment);
+                std::unique_lock lock(large_mtx);
+                large.in_use--;
+                return;
+            }
+            auto &c = classes[i];
+            std::unique_lock lock(c.mtx);
+            auto *b = static_cast<FreeBlock *>(p);
+            b->next = c.free_list;
+            c.free_list = b;
+            c.stat.in_use--;
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+            return this == &other;
+        }
+
+    public:
+        explicit SlabResource(std::pmr::memory_resource *up = std::pmr::new_delete_resource()) : upstream(up) {
+            std::size_t s = MIN_BLOCK;
+            for (auto &c: classes) c.stat.block_size = s, s <<= 1;
+        }
+
+        ~SlabResource() override {
+            for (auto &c: classes) {
+                for (auto *slab: c.slabs) upstream->deallocate(slab, slab_bytes(c.stat.block_size), SLAB_ALIGN);
+            }
+        }
+
+        SlabResource(const SlabResource &) = delete;
+
+        SlabResource &operator=(const SlabResource &) = delete;
+
+        // 各类别的占用统计，最后一项为直接从上游分配的大块。
+        std::vector<SlabStat> stats() {
+            std::vector<SlabStat> v;
+            for (auto &c: classes) {
+                std::unique_lock lock(c.mtx);
+                v.push_back(c.stat);
+            }
+            std::unique_lock lock(large_mtx);
+            v.push_back(large);
+            return v;
+        }
+    };
+}
+
+#endif /* TOS_SLABRESOURCE_H */
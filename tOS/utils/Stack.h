@@ -5,50 +5,72 @@
 #ifndef TOS_STACK_H
 #define TOS_STACK_H
 
+#include "../tOS_config.h"
+#include "RawStorage.h"
 #include <cstdint>
 #include <stdexcept>
 
 namespace tOS {
     /* 无锁栈
+     * 元素存放在未初始化的存储中，入栈时原地构造，出栈时析构。
      * T: 栈元素类型
-     * size: 栈容量
+     * size: 栈容量，为DYNAMIC_SIZE时在运行时确定
      * CHECK: 是否开启运行时错误检查
      */
     template<class T, std::size_t SIZE, bool CHECK = TOS_CHECK_DEFAULT>
     class Stack {
     private:
-        T buffer[SIZE];
+        RawStorage<T, SIZE> buffer;
         std::size_t top;
     public:
         using ValType = T;
 
         Stack() : top(0) {};
 
+        // 仅用于SIZE为DYNAMIC_SIZE的情况，参见RawStorage。
+        Stack(std::size_t capacity, std::size_t max_capacity) : buffer(capacity, max_capacity), top(0) {};
+
+        ~Stack() {
+            while (top > 0) buffer.destroy(--top);
+        }
+
+        Stack(const Stack &) = delete;
+
+        Stack &operator=(const Stack &) = delete;
+
         inline std::size_t size() const { return top; }
 
         inline bool empty() const { return top == 0; }
 
-        inline bool full() const { return top == SIZE; }
+        inline bool full() const { return top == buffer.capacity(); }
 
         inline void push(const T &obj) {
             if constexpr(CHECK) if (full()) throw std::range_error("queue full!");
-            buffer[top++] = obj;
+            buffer.reserve(top + 1, 0, top);
+            buffer.construct(top, obj);
+            top++;
         }
 
         inline void push(T &&obj) {
             if constexpr(CHECK) if (full()) throw std::range_error("queue full!");
-            buffer[top++] = std::move(obj);
+            buffer.reserve(top + 1, 0, top);
+            buffer.construct(top, std::move(obj));
+            top++;
         }
 
         template<class ...Ts>
         inline void emplace(Ts &&... args) {
             if constexpr(CHECK) if (full()) throw std::range_error("queue full!");
-            buffer[top++] = T{std::forward<Ts>(args)...};
+            buffer.reserve(top + 1, 0, top);
+            buffer.construct(top, std::forward<Ts>(args)...);
+            top++;
         }
 
         inline T pop() {
             if constexpr(CHECK) if (empty()) throw std::range_error("queue empty!");
-            return std::move(buffer[--top]);
+            T obj = std::move(buffer[--top]);
+            buffer.destroy(top);
+            return obj;
         }
     };
 